@@ -0,0 +1,706 @@
+/*
+ * Microbenchmarks for the operations of queue.h.
+ *
+ * Every operation is timed on queues of 10^2 up to 10^7 elements, holding
+ * strings of 4 up to 1024 characters. Operations taking constant time are
+ * timed over BATCH calls on a queue kept at its size, and bulk insertions
+ * and removals over one call moving BATCH elements. The others are timed
+ * one call at a time, on a queue rebuilt beforehand whenever the call
+ * consumes it. Each case is run once to warm up, then repeated until at
+ * least MIN_REPS measurements are in and TIME_BUDGET seconds have gone into
+ * them, counting the untimed rebuilds, which dominate on large queues. Their
+ * median and median absolute deviation (MAD) are reported per call, or per
+ * element for bulk calls, in nanoseconds and in cycles read with
+ * cpucycles().
+ *
+ * Results are written as JSON. Given a baseline written by an earlier run,
+ * every case that got slower than it by more than a threshold is reported,
+ * and the exit status is non-zero.
+ *
+ * This is built like qtest-perf, with the allocation checks of the harness
+ * compiled out, so that what is measured is the queue code.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpucycles.h"
+
+/* Our program needs the real malloc, free and strdup */
+#define INTERNAL 1
+#include "harness.h"
+#include "queue.h"
+#include "random.h"
+
+/* Calls timed at once for operations taking constant time */
+#define BATCH 64
+
+#define MIN_REPS 5
+#define MAX_REPS 101
+#define TIME_BUDGET 0.2 /* Seconds per case, rebuilds included */
+
+/* Bytes an element takes on top of its string, to check the memory limit */
+#define ELEMENT_BYTES 96
+
+/* A case is skipped if its queue and strings would need more than this */
+#define DEFAULT_MEM_MB 1024
+
+#define DEFAULT_THRESHOLD 10.0
+#define DEFAULT_THREADS 4
+
+static const long sizes[] = {100, 1000, 10000, 100000, 1000000, 10000000};
+static const int lengths[] = {4, 16, 64, 256, 1024};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct {
+    char op[32];
+    long size;
+    int len;
+    int reps;
+    double ns, ns_mad;         /* Per call, or element for bulk calls */
+    double cycles, cycles_mad; /* Likewise */
+} result_t;
+
+typedef struct {
+    result_t *r;
+    int n, cap;
+} results_t;
+
+/* State of the case being measured */
+typedef struct {
+    struct list_head *q;
+    long size;
+    int len;
+    char *strs; /* size strings, each len + 1 bytes after the previous one */
+    char *batch[BATCH];
+    char *buf; /* Receives removed strings */
+    element_t *removed[BATCH];
+    struct list_head out;
+    struct list_head *queues[BATCH];
+    int threads;
+} bench_t;
+
+/* Keeps calls whose result is unused from being optimized away */
+static volatile long sink;
+
+static inline char *str(bench_t *b, long i)
+{
+    return b->strs + i * (b->len + 1);
+}
+
+/*
+ * Random lowercase strings, half of them copies of the previous one, so
+ * that a sorted queue of them has duplicates for q_delete_dup to delete.
+ */
+static void fill_strings(bench_t *b)
+{
+    for (long i = 0; i < b->size; i++) {
+        char *s = str(b, i);
+        if (i > 0 && randombit())
+            memcpy(s, str(b, i - 1), b->len);
+        else {
+            prng_fill((uint8_t *) s, b->len);
+            for (int j = 0; j < b->len; j++)
+                s[j] = 'a' + (uint8_t) s[j] % 26;
+        }
+        s[b->len] = '\0';
+    }
+    for (int i = 0; i < BATCH; i++)
+        b->batch[i] = str(b, i);
+}
+
+static void rebuild(bench_t *b)
+{
+    q_free(b->q);
+    b->q = q_new();
+    for (long i = 0; i < b->size; i++) {
+        if (!q_insert_tail(b->q, str(b, i))) {
+            fprintf(stderr, "FATAL: Could not allocate queue of %ld\n",
+                    b->size);
+            exit(1);
+        }
+    }
+}
+
+static void release_out(bench_t *b)
+{
+    element_t *e, *safe;
+    list_for_each_entry_safe (e, safe, &b->out, list)
+        q_release_element(e);
+}
+
+static void release_removed(bench_t *b)
+{
+    for (int i = 0; i < BATCH; i++)
+        q_release_element(b->removed[i]);
+}
+
+/* Timed parts, and the untimed work bringing the queue back to its size */
+
+static void run_new(bench_t *b)
+{
+    for (int i = 0; i < BATCH; i++)
+        b->queues[i] = q_new();
+}
+
+static void restore_new(bench_t *b)
+{
+    for (int i = 0; i < BATCH; i++)
+        q_free(b->queues[i]);
+}
+
+static void run_insert_head(bench_t *b)
+{
+    for (int i = 0; i < BATCH; i++)
+        q_insert_head(b->q, b->batch[i]);
+}
+
+static void run_insert_tail(bench_t *b)
+{
+    for (int i = 0; i < BATCH; i++)
+        q_insert_tail(b->q, b->batch[i]);
+}
+
+static void run_insert_head_bulk(bench_t *b)
+{
+    q_insert_head_bulk(b->q, b->batch, BATCH);
+}
+
+static void run_insert_tail_bulk(bench_t *b)
+{
+    q_insert_tail_bulk(b->q, b->batch, BATCH);
+}
+
+static void trim_head(bench_t *b)
+{
+    q_remove_head_n(b->q, &b->out, BATCH);
+    release_out(b);
+}
+
+static void trim_tail(bench_t *b)
+{
+    q_remove_tail_n(b->q, &b->out, BATCH);
+    release_out(b);
+}
+
+static void run_remove_head(bench_t *b)
+{
+    for (int i = 0; i < BATCH; i++)
+        b->removed[i] = q_remove_head(b->q, b->buf, b->len + 1);
+}
+
+static void run_remove_tail(bench_t *b)
+{
+    for (int i = 0; i < BATCH; i++)
+        b->removed[i] = q_remove_tail(b->q, b->buf, b->len + 1);
+}
+
+static void refill_head(bench_t *b)
+{
+    release_removed(b);
+    q_insert_head_bulk(b->q, b->batch, BATCH);
+}
+
+static void refill_tail(bench_t *b)
+{
+    release_removed(b);
+    q_insert_tail_bulk(b->q, b->batch, BATCH);
+}
+
+static void run_remove_head_n(bench_t *b)
+{
+    q_remove_head_n(b->q, &b->out, BATCH);
+}
+
+static void run_remove_tail_n(bench_t *b)
+{
+    q_remove_tail_n(b->q, &b->out, BATCH);
+}
+
+static void refill_head_n(bench_t *b)
+{
+    release_out(b);
+    q_insert_head_bulk(b->q, b->batch, BATCH);
+}
+
+static void refill_tail_n(bench_t *b)
+{
+    release_out(b);
+    q_insert_tail_bulk(b->q, b->batch, BATCH);
+}
+
+static void run_size(bench_t *b)
+{
+    long sum = 0;
+    for (int i = 0; i < BATCH; i++)
+        sum += q_size(b->q);
+    sink = sum;
+}
+
+static void run_delete_mid(bench_t *b)
+{
+    q_delete_mid(b->q);
+}
+
+static void restore_delete_mid(bench_t *b)
+{
+    q_insert_tail(b->q, b->batch[0]);
+}
+
+static void run_swap(bench_t *b)
+{
+    q_swap(b->q);
+}
+
+static void run_reverse(bench_t *b)
+{
+    q_reverse(b->q);
+}
+
+static void run_sort(bench_t *b)
+{
+    q_sort(b->q);
+}
+
+static void run_sort_parallel(bench_t *b)
+{
+    q_sort_parallel(b->q, b->threads);
+}
+
+static void sorted(bench_t *b)
+{
+    rebuild(b);
+    q_sort(b->q);
+}
+
+static void run_delete_dup(bench_t *b)
+{
+    q_delete_dup(b->q);
+}
+
+static void run_delete_dup_unsorted(bench_t *b)
+{
+    q_delete_dup_unsorted(b->q);
+}
+
+static void run_free(bench_t *b)
+{
+    q_free(b->q);
+    b->q = NULL;
+}
+
+typedef struct {
+    const char *name;
+    int calls; /* Calls, or elements for the bulk calls, one run() makes */
+    void (*prepare)(bench_t *b); /* Untimed, before run(), or NULL */
+    void (*run)(bench_t *b);
+    void (*restore)(bench_t *b); /* Untimed, after run(), or NULL */
+} bench_op_t;
+
+/*
+ * Operations that leave the queue as they found it come first. Those that
+ * change its size or order rebuild it in prepare().
+ */
+static const bench_op_t ops[] = {
+    {"new", BATCH, NULL, run_new, restore_new},
+    {"insert_head", BATCH, NULL, run_insert_head, trim_head},
+    {"insert_tail", BATCH, NULL, run_insert_tail, trim_tail},
+    {"insert_head_bulk", BATCH, NULL, run_insert_head_bulk, trim_head},
+    {"insert_tail_bulk", BATCH, NULL, run_insert_tail_bulk, trim_tail},
+    {"remove_head", BATCH, NULL, run_remove_head, refill_head},
+    {"remove_tail", BATCH, NULL, run_remove_tail, refill_tail},
+    {"remove_head_n", BATCH, NULL, run_remove_head_n, refill_head_n},
+    {"remove_tail_n", BATCH, NULL, run_remove_tail_n, refill_tail_n},
+    {"size", BATCH, NULL, run_size, NULL},
+    {"delete_mid", 1, NULL, run_delete_mid, restore_delete_mid},
+    {"swap", 1, NULL, run_swap, NULL},
+    {"reverse", 1, NULL, run_reverse, NULL},
+    {"sort", 1, rebuild, run_sort, NULL},
+    {"sort_parallel", 1, rebuild, run_sort_parallel, NULL},
+    {"delete_dup", 1, sorted, run_delete_dup, NULL},
+    {"delete_dup_unsorted", 1, rebuild, run_delete_dup_unsorted, NULL},
+    {"free", 1, rebuild, run_free, NULL},
+};
+
+static double seconds(const struct timespec *t)
+{
+    return t->tv_sec + t->tv_nsec * 1e-9;
+}
+
+/*
+ * Time one run() of op, in nanoseconds and cycles.
+ * Return the seconds taken in all, prepare() and restore() included.
+ */
+static double measure(bench_t *b, const bench_op_t *op, double *ns,
+                      double *cycles)
+{
+    struct timespec start, t0, t1, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (op->prepare)
+        op->prepare(b);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int64_t c0 = cpucycles();
+    op->run(b);
+    int64_t c1 = cpucycles_end();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (op->restore)
+        op->restore(b);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *ns = (seconds(&t1) - seconds(&t0)) * 1e9;
+    *cycles = (double) (c1 - c0);
+    return seconds(&end) - seconds(&start);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Median of x[0..n), which is reordered. Return its MAD in *mad */
+static double median(double *x, int n, double *mad)
+{
+    qsort(x, n, sizeof(double), cmp_double);
+    double med = n % 2 ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+
+    for (int i = 0; i < n; i++)
+        x[i] = x[i] > med ? x[i] - med : med - x[i];
+    qsort(x, n, sizeof(double), cmp_double);
+    *mad = n % 2 ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+    return med;
+}
+
+static result_t *add_result(results_t *rs)
+{
+    if (rs->n == rs->cap) {
+        rs->cap = rs->cap ? 2 * rs->cap : 256;
+        rs->r = realloc(rs->r, rs->cap * sizeof(result_t));
+        if (!rs->r) {
+            fprintf(stderr, "FATAL: Out of memory\n");
+            exit(1);
+        }
+    }
+    return memset(&rs->r[rs->n++], 0, sizeof(result_t));
+}
+
+static void run_case(bench_t *b, const bench_op_t *op, int max_reps,
+                     results_t *rs)
+{
+    double ns[MAX_REPS], cycles[MAX_REPS];
+    double spent = 0;
+    int reps = 0;
+
+    /* Warm up caches, the allocator and the branch predictors */
+    measure(b, op, &ns[0], &cycles[0]);
+
+    while (reps < max_reps && (reps < MIN_REPS || spent < TIME_BUDGET)) {
+        spent += measure(b, op, &ns[reps], &cycles[reps]);
+        reps++;
+    }
+
+    result_t *r = add_result(rs);
+    snprintf(r->op, sizeof(r->op), "%s", op->name);
+    r->size = b->size;
+    r->len = b->len;
+    r->reps = reps;
+    r->ns = median(ns, reps, &r->ns_mad) / op->calls;
+    r->ns_mad /= op->calls;
+    r->cycles = median(cycles, reps, &r->cycles_mad) / op->calls;
+    r->cycles_mad /= op->calls;
+}
+
+static void run_all(long max_size, long mem_mb, int max_reps, int threads,
+                    bool verbose, results_t *rs)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sizes) && sizes[i] <= max_size; i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(lengths); j++) {
+            bench_t b = {.size = sizes[i], .len = lengths[j]};
+            double mb = (double) b.size * (2 * (b.len + 1) + ELEMENT_BYTES) /
+                        (1 << 20);
+            if (mb > mem_mb) {
+                fprintf(stderr, "Skipping size %ld, length %d: needs %.0f MB\n",
+                        b.size, b.len, mb);
+                continue;
+            }
+            fprintf(stderr, "Size %ld, length %d\n", b.size, b.len);
+
+            b.strs = malloc(b.size * (b.len + 1));
+            b.buf = malloc(b.len + 1);
+            if (!b.strs || !b.buf) {
+                fprintf(stderr, "FATAL: Out of memory\n");
+                exit(1);
+            }
+            b.threads = threads;
+            fill_strings(&b);
+            rebuild(&b);
+
+            for (size_t k = 0; k < ARRAY_SIZE(ops); k++) {
+                if (!b.q)
+                    rebuild(&b);
+                run_case(&b, &ops[k], max_reps, rs);
+                if (verbose) {
+                    result_t *r = &rs->r[rs->n - 1];
+                    fprintf(stderr, "  %-20s %12.1f ns %12.1f cycles\n",
+                            r->op, r->ns, r->cycles);
+                }
+            }
+
+            q_free(b.q);
+            free(b.strs);
+            free(b.buf);
+        }
+    }
+}
+
+static const char *storage()
+{
+#ifdef QUEUE_CHUNKED
+    return "chunked";
+#else
+    return q_use_pool ? "pool" : "malloc";
+#endif
+}
+
+static bool write_results(const char *file_name, const results_t *rs)
+{
+    FILE *f = file_name ? fopen(file_name, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Could not open '%s' for writing\n", file_name);
+        return false;
+    }
+
+    fprintf(f, "{\n  \"storage\": \"%s\",\n  \"interned\": %s,\n", storage(),
+            q_intern_value ? "true" : "false");
+    fprintf(f, "  \"batch\": %d,\n", BATCH);
+    fprintf(f, "  \"results\": [\n");
+    for (int i = 0; i < rs->n; i++) {
+        const result_t *r = &rs->r[i];
+        fprintf(f,
+                "    {\"op\": \"%s\", \"size\": %ld, \"strlen\": %d, "
+                "\"reps\": %d, \"ns_per_op\": %.2f, \"ns_mad\": %.2f, "
+                "\"cycles_per_op\": %.2f, \"cycles_mad\": %.2f}%s\n",
+                r->op, r->size, r->len, r->reps, r->ns, r->ns_mad, r->cycles,
+                r->cycles_mad, i + 1 < rs->n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    if (f != stdout)
+        fclose(f);
+    return true;
+}
+
+/*
+ * Read results written by write_results(). This is no JSON parser: every
+ * result has to be an object with the members in the order written.
+ */
+static bool read_results(const char *file_name, results_t *rs)
+{
+    FILE *f = fopen(file_name, "r");
+    if (!f) {
+        fprintf(stderr, "Could not open '%s'\n", file_name);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    rewind(f);
+    char *text = malloc(len + 1);
+    if (!text || fread(text, 1, len, f) != (size_t) len) {
+        fprintf(stderr, "Could not read '%s'\n", file_name);
+        free(text);
+        fclose(f);
+        return false;
+    }
+    text[len] = '\0';
+    fclose(f);
+
+    for (char *p = strstr(text, "{\"op\""); p; p = strstr(p + 1, "{\"op\"")) {
+        result_t *r = add_result(rs);
+        if (sscanf(p,
+                   "{\"op\": \"%31[^\"]\", \"size\": %ld, \"strlen\": %d, "
+                   "\"reps\": %d, \"ns_per_op\": %lf, \"ns_mad\": %lf, "
+                   "\"cycles_per_op\": %lf, \"cycles_mad\": %lf}",
+                   r->op, &r->size, &r->len, &r->reps, &r->ns, &r->ns_mad,
+                   &r->cycles, &r->cycles_mad) != 8) {
+            fprintf(stderr, "Malformed result in '%s': %.40s\n", file_name,
+                    p);
+            free(text);
+            return false;
+        }
+    }
+    free(text);
+    return true;
+}
+
+/*
+ * A case has regressed if its median time grew by more than threshold
+ * percent, and by more than three times the larger MAD, so that a noisy
+ * case does not raise alarms. Return the number of regressions.
+ */
+static int compare(const results_t *rs, const results_t *base,
+                   double threshold)
+{
+    int regressions = 0, matched = 0;
+
+    for (int i = 0; i < rs->n; i++) {
+        const result_t *r = &rs->r[i];
+        const result_t *old = NULL;
+        for (int j = 0; j < base->n && !old; j++) {
+            const result_t *c = &base->r[j];
+            if (!strcmp(c->op, r->op) && c->size == r->size &&
+                c->len == r->len)
+                old = c;
+        }
+        if (!old)
+            continue;
+        matched++;
+
+        double mad = r->ns_mad > old->ns_mad ? r->ns_mad : old->ns_mad;
+        if (r->ns > old->ns * (1 + threshold / 100) &&
+            r->ns - old->ns > 3 * mad) {
+            printf("REGRESSION %s size %ld length %d: %.1f -> %.1f ns "
+                   "(%+.1f%%)\n",
+                   r->op, r->size, r->len, old->ns, r->ns,
+                   (r->ns / old->ns - 1) * 100);
+            regressions++;
+        }
+    }
+
+    printf("%d of %d cases slower than the baseline by more than %.1f%%\n",
+           regressions, matched, threshold);
+    return regressions;
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-o OFILE][-i IFILE][-c BFILE][-t PCT]\n"
+           "       [-s SIZE][-m MB][-r REPS][-j THREADS][-p][-I][-v]\n",
+           cmd);
+    printf("\t-h          Print this information\n");
+    printf("\t-o OFILE    Write results to OFILE instead of stdout\n");
+    printf("\t-i IFILE    Read results from IFILE instead of measuring\n");
+    printf("\t-c BFILE    Compare results with the baseline in BFILE, and\n"
+           "\t            exit with status 1 if any case regressed\n");
+    printf("\t-t PCT      Slowdown that counts as a regression (%.0f%%)\n",
+           DEFAULT_THRESHOLD);
+    printf("\t-s SIZE     Largest queue size to measure (%ld)\n",
+           sizes[ARRAY_SIZE(sizes) - 1]);
+    printf("\t-m MB       Skip cases needing more memory (%d)\n",
+           DEFAULT_MEM_MB);
+    printf("\t-r REPS     Most measurements per case (%d)\n", MAX_REPS);
+    printf("\t-j THREADS  Threads for q_sort_parallel (%d)\n",
+           DEFAULT_THREADS);
+    printf("\t-p          Allocate elements from per-queue pools\n");
+    printf("\t-I          Intern the strings of inserted elements\n");
+    printf("\t-v          Show every result while measuring\n");
+    exit(0);
+}
+
+static long parse_long(const char *s, long min, long max, const char *what)
+{
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end || v < min || v > max) {
+        fprintf(stderr, "Invalid %s '%s'\n", what, s);
+        exit(EXIT_FAILURE);
+    }
+    return v;
+}
+
+int main(int argc, char *argv[])
+{
+    char *out_name = NULL, *in_name = NULL, *base_name = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    long max_size = sizes[ARRAY_SIZE(sizes) - 1];
+    long mem_mb = DEFAULT_MEM_MB;
+    int max_reps = MAX_REPS, threads = DEFAULT_THREADS;
+    bool verbose = false;
+    int c;
+
+    static const struct option long_options[] = {
+        {"compare", required_argument, NULL, 'c'},
+        {"threshold", required_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    while ((c = getopt_long(argc, argv, "ho:i:c:t:s:m:r:j:pIv", long_options,
+                            NULL)) != -1) {
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        case 'i':
+            in_name = optarg;
+            break;
+        case 'c':
+            base_name = optarg;
+            break;
+        case 't': {
+            char *end;
+            threshold = strtod(optarg, &end);
+            if (end == optarg || *end || threshold < 0) {
+                fprintf(stderr, "Invalid threshold '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 's':
+            max_size = parse_long(optarg, sizes[0], 1L << 40, "size");
+            break;
+        case 'm':
+            mem_mb = parse_long(optarg, 1, 1L << 40, "memory limit");
+            break;
+        case 'r':
+            max_reps = parse_long(optarg, MIN_REPS, MAX_REPS, "repetitions");
+            break;
+        case 'j':
+            threads = parse_long(optarg, 1, 64, "thread count");
+            break;
+        case 'p':
+            q_use_pool = 1;
+            break;
+        case 'I':
+            q_intern_value = 1;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            break;
+        }
+    }
+
+    results_t rs = {0}, base = {0};
+    if (in_name) {
+        if (!read_results(in_name, &rs))
+            return 1;
+    } else {
+        run_all(max_size, mem_mb, max_reps, threads, verbose, &rs);
+        /* With a comparison to print, stdout is not for the results */
+        if ((out_name || !base_name) && !write_results(out_name, &rs))
+            return 1;
+    }
+
+    int regressions = 0;
+    if (base_name) {
+        if (!read_results(base_name, &base))
+            return 1;
+        regressions = compare(&rs, &base, threshold);
+    }
+
+    free(rs.r);
+    free(base.r);
+    return regressions ? 1 : 0;
+}
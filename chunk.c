@@ -0,0 +1,173 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "chunk.h"
+#include "harness.h"
+
+/* Every chunk starts with this header, its slots follow */
+struct chunk {
+    struct chunk *prev, *next; /* Neighbours towards the head and the tail */
+    chunk_deque_t *owner;
+    int live; /* Slots handed out and not given back yet */
+};
+
+/* Word placed at the start of every slot, in front of the object */
+typedef struct {
+    struct chunk *chunk;
+} slot_header_t;
+
+static inline slot_header_t *slot(struct chunk *c, int i)
+{
+    return (slot_header_t *) ((char *) (c + 1) + (size_t) i * CHUNK_SLOT_SIZE);
+}
+
+void chunk_init(chunk_deque_t *dq)
+{
+    dq->first = dq->last = NULL;
+    dq->head_slot = dq->tail_slot = 0;
+    dq->spare = NULL;
+}
+
+/* Take the spare chunk, or a new one. Return NULL if could not allocate */
+static struct chunk *get_chunk(chunk_deque_t *dq)
+{
+    struct chunk *c = dq->spare;
+    if (c)
+        dq->spare = NULL;
+    else {
+        c = malloc(sizeof(struct chunk) + CHUNK_SLOTS * CHUNK_SLOT_SIZE);
+        if (!c)
+            return NULL;
+    }
+
+    c->prev = c->next = NULL;
+    c->owner = dq;
+    c->live = 0;
+    return c;
+}
+
+/* Make c the only chunk, with room on both sides of its middle slot */
+static void start_over(chunk_deque_t *dq, struct chunk *c)
+{
+    dq->first = dq->last = c;
+    dq->head_slot = dq->tail_slot = CHUNK_SLOTS / 2;
+}
+
+static void *hand_out(struct chunk *c, int i)
+{
+    slot_header_t *h = slot(c, i);
+    h->chunk = c;
+    c->live++;
+    return h + 1;
+}
+
+void *chunk_alloc_head(chunk_deque_t *dq)
+{
+    if (!dq->first || dq->head_slot == 0) {
+        struct chunk *c = get_chunk(dq);
+        if (!c)
+            return NULL;
+        if (!dq->first)
+            start_over(dq, c);
+        else {
+            c->next = dq->first;
+            dq->first->prev = c;
+            dq->first = c;
+            dq->head_slot = CHUNK_SLOTS;
+        }
+    }
+
+    return hand_out(dq->first, --dq->head_slot);
+}
+
+void *chunk_alloc_tail(chunk_deque_t *dq)
+{
+    if (!dq->last || dq->tail_slot == CHUNK_SLOTS) {
+        struct chunk *c = get_chunk(dq);
+        if (!c)
+            return NULL;
+        if (!dq->last)
+            start_over(dq, c);
+        else {
+            c->prev = dq->last;
+            dq->last->next = c;
+            dq->last = c;
+            dq->tail_slot = 0;
+        }
+    }
+
+    return hand_out(dq->last, dq->tail_slot++);
+}
+
+/* Drop c, whose last slot has just been given back */
+static void retire(chunk_deque_t *dq, struct chunk *c)
+{
+    if (dq->first == dq->last) {
+        /* Nothing is left in the deque, so all of c can be used again */
+        start_over(dq, c);
+        return;
+    }
+
+    /* The end moves to the neighbour, whose free slots are not tracked */
+    if (c == dq->first) {
+        dq->first = c->next;
+        dq->head_slot = 0;
+    } else if (c == dq->last) {
+        dq->last = c->prev;
+        dq->tail_slot = CHUNK_SLOTS;
+    }
+    if (c->prev)
+        c->prev->next = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+
+    if (!dq->spare)
+        dq->spare = c;
+    else
+        free(c);
+}
+
+void chunk_free(void *p)
+{
+    if (!p)
+        return;
+
+    struct chunk *c = ((slot_header_t *) p - 1)->chunk;
+    if (--c->live == 0)
+        retire(c->owner, c);
+}
+
+void chunk_adopt(chunk_deque_t *dq, chunk_deque_t *from)
+{
+    if (!from->first)
+        return;
+
+    for (struct chunk *c = from->first; c; c = c->next)
+        c->owner = dq;
+
+    if (!dq->first) {
+        dq->first = from->first;
+        dq->head_slot = from->head_slot;
+    } else {
+        dq->last->next = from->first;
+        from->first->prev = dq->last;
+    }
+    dq->last = from->last;
+    dq->tail_slot = from->tail_slot;
+
+    from->first = from->last = NULL;
+    from->head_slot = from->tail_slot = 0;
+}
+
+void chunk_destroy(chunk_deque_t *dq)
+{
+    struct chunk *c = dq->first;
+    while (c) {
+        struct chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    free(dq->spare);
+
+    chunk_init(dq);
+}
@@ -0,0 +1,68 @@
+#ifndef LAB0_CHUNK_H
+#define LAB0_CHUNK_H
+
+/*
+ * Chunked deque storage for queue elements.
+ *
+ * Elements live in the fixed-size slots of chunks, which are kept in queue
+ * order: insertions at the tail fill the tail chunk upwards, insertions at
+ * the head fill the head chunk downwards, and a fresh chunk is linked in at
+ * an end once its chunk is full. As long as a queue grows and shrinks at its
+ * ends, walking it walks memory sequentially, and malloc is called once per
+ * CHUNK_SLOTS elements.
+ *
+ * A released slot is not handed out again by itself. Its chunk goes away
+ * once all of its slots are released and it is no longer at an end, except
+ * that one empty chunk is kept for the next time an end needs a fresh one.
+ * A FIFO workload thus cycles through two chunks without calling malloc.
+ *
+ * Chunks come from the harness malloc like any other block. Hence they show
+ * up in allocation_check() until they are released.
+ */
+
+#include <stddef.h>
+
+/* Bytes per slot, including the per-slot header */
+#define CHUNK_SLOT_SIZE 64
+#define CHUNK_SLOTS 64
+
+/* Largest object a slot can hold */
+#define CHUNK_OBJ_SIZE (CHUNK_SLOT_SIZE - sizeof(struct chunk *))
+
+struct chunk;
+
+typedef struct chunk_deque {
+    struct chunk *first, *last; /* Chunks at the head and at the tail end */
+    int head_slot;              /* Lowest slot of first handed out so far */
+    int tail_slot;              /* Next slot of last to hand out */
+    struct chunk *spare;        /* Empty chunk kept for reuse, or NULL */
+} chunk_deque_t;
+
+/* Prepare an empty deque. No memory is allocated until first use */
+void chunk_init(chunk_deque_t *dq);
+
+/*
+ * Get a slot in front of, or behind, all slots handed out so far.
+ * Return NULL if could not allocate space.
+ */
+void *chunk_alloc_head(chunk_deque_t *dq);
+void *chunk_alloc_tail(chunk_deque_t *dq);
+
+/* Give back a slot obtained from the deque owning it */
+void chunk_free(void *p);
+
+/*
+ * Make dq the owner of every chunk of from, except its spare one, and leave
+ * from empty. The chunks are linked in behind the tail of dq, so the slots
+ * left at its tail are not handed out any more. Takes time linear in the
+ * number of chunks of from.
+ */
+void chunk_adopt(chunk_deque_t *dq, chunk_deque_t *from);
+
+/*
+ * Release every chunk of dq at once.
+ * Slots that have not been given back become invalid as well.
+ */
+void chunk_destroy(chunk_deque_t *dq);
+
+#endif /* LAB0_CHUNK_H */
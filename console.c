@@ -3,6 +3,7 @@
 #include "console.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -10,17 +11,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
+#include "server.h"
 
 /* Some global values */
 int simulation = 0;
+unsigned cmd_count = 0;
 static cmd_ptr cmd_list = NULL;
 static param_ptr param_list = NULL;
+
+/*
+ * Commands and parameters live in separate namespaces, but are hashed the
+ * same way. Both tables are chained through the hnext field of their entries.
+ */
+#define NAME_HASH_SIZE 64 /* Must be a power of 2 */
+static cmd_ptr cmd_table[NAME_HASH_SIZE];
+static param_ptr param_table[NAME_HASH_SIZE];
+
+/*
+ * Storage for the words of the command line being interpreted, kept across
+ * commands and only grown when a longer line shows up
+ */
+static char *arg_buf = NULL;
+static size_t arg_buf_size = 0;
+static char **arg_vec = NULL;
+static size_t arg_vec_size = 0;
 static bool block_flag = false;
 static bool prompt_flag = true;
 
@@ -31,9 +53,30 @@ static bool block_timing = false;
 static double first_time;
 static double last_time;
 
+/*
+ * Per-command latency profile.
+ * When 'option profile' is on, the time taken by every dispatched command is
+ * recorded in a log-linear histogram of nanoseconds: values below PROF_SUB
+ * are counted exactly, larger ones in PROF_SUB buckets per power of two.
+ * Percentiles read from it are therefore off by at most 1/PROF_SUB.
+ */
+static int profile = 0;
+
+#define PROF_SUB_BITS 3
+#define PROF_SUB (1 << PROF_SUB_BITS)
+#define PROF_BUCKETS (PROF_SUB + (64 - PROF_SUB_BITS) * PROF_SUB)
+
+struct cmd_profile {
+    uint64_t count;
+    uint64_t total, min, max; /* In nanoseconds */
+    uint64_t buckets[PROF_BUCKETS];
+};
+
 /*
  * Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
+ * Regular files are mapped into memory instead, and their lines are handed
+ * out in place.
  */
 
 #define RIO_BUFSIZE 8192
@@ -44,6 +87,9 @@ struct RIO_ELE {
     int cnt;               /* Unread bytes in internal buffer */
     char *bufptr;          /* Next unread byte in internal buffer */
     char buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *map;             /* Mapping of the whole file, or NULL */
+    size_t map_len;        /* Length of the mapping */
+    char *map_pos;         /* Next unread byte in the mapping */
     rio_ptr prev;          /* Next element in stack */
 };
 
@@ -62,6 +108,13 @@ static bool quit_flag = false;
 static char *prompt = "cmd> ";
 static bool has_infile = false;
 
+/*
+ * Whether commands typed in the terminal are read by linenoise. Once the
+ * console listens for clients, they come through cmd_select() instead, which
+ * waits for both.
+ */
+static bool use_linenoise = true;
+
 /* Optional function to call as part of exit process */
 /* Maximum number of quit functions */
 
@@ -76,6 +129,33 @@ static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
 
+/* FNV-1a, reduced to a bucket of a name table */
+static unsigned name_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h & (NAME_HASH_SIZE - 1);
+}
+
+static cmd_ptr find_cmd(const char *name)
+{
+    cmd_ptr c = cmd_table[name_hash(name)];
+    while (c && strcmp(name, c->name) != 0)
+        c = c->hnext;
+    return c;
+}
+
+static param_ptr find_param(const char *name)
+{
+    param_ptr p = param_table[name_hash(name)];
+    while (p && strcmp(name, p->name) != 0)
+        p = p->hnext;
+    return p;
+}
+
 /* Add a new command */
 void add_cmd(char *name, cmd_function operation, char *documentation)
 {
@@ -90,8 +170,13 @@ void add_cmd(char *name, cmd_function operation, char *documentation)
     ele->name = name;
     ele->operation = operation;
     ele->documentation = documentation;
+    ele->profile = NULL;
     ele->next = next_cmd;
     *last_loc = ele;
+
+    unsigned h = name_hash(name);
+    ele->hnext = cmd_table[h];
+    cmd_table[h] = ele;
 }
 
 /* Add a new parameter */
@@ -114,25 +199,61 @@ void add_param(char *name,
     ele->setter = setter;
     ele->next = next_param;
     *last_loc = ele;
+
+    unsigned h = name_hash(name);
+    ele->hnext = param_table[h];
+    param_table[h] = ele;
+}
+
+/* Make the argument arena able to hold a line of len characters */
+static void reserve_args(size_t len)
+{
+    if (len + 1 > arg_buf_size) {
+        if (arg_buf)
+            free_block(arg_buf, arg_buf_size);
+        arg_buf_size = len + 1 > 2 * arg_buf_size ? len + 1 : 2 * arg_buf_size;
+        arg_buf = malloc_or_fail(arg_buf_size, "reserve_args");
+    }
+
+    /* Words are separated by white space, so there are at most this many */
+    size_t max_argc = len / 2 + 1;
+    if (max_argc > arg_vec_size) {
+        if (arg_vec)
+            free_array(arg_vec, arg_vec_size, sizeof(char *));
+        size_t want = 2 * arg_vec_size;
+        arg_vec_size = max_argc > want ? max_argc : want;
+        arg_vec = calloc_or_fail(arg_vec_size, sizeof(char *), "reserve_args");
+    }
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+static void release_args()
 {
-    /*
-     * Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
-    char *src = line;
-    char *dst = buf;
+    if (arg_buf)
+        free_block(arg_buf, arg_buf_size);
+    if (arg_vec)
+        free_array(arg_vec, arg_vec_size, sizeof(char *));
+    arg_buf = NULL;
+    arg_vec = NULL;
+    arg_buf_size = arg_vec_size = 0;
+}
+
+/*
+ * Parse the len characters at line into a command line.
+ * The words are copied into the argument arena, each one null-terminated,
+ * and the returned array points into it. Both stay valid until the next line
+ * is parsed.
+ */
+static char **parse_args(const char *line, size_t len, int *argcp)
+{
+    reserve_args(len);
+
+    const char *src = line;
+    const char *end = line + len;
+    char *dst = arg_buf;
     bool skipping = true;
     int c;
     int argc = 0;
-    while ((c = *src++) != '\0') {
+    while (src < end && (c = *src++) != '\0') {
         if (isspace(c)) {
             if (!skipping) {
                 /* Hit end of word */
@@ -142,24 +263,96 @@ static char **parse_args(char *line, int *argcp)
         } else {
             if (skipping) {
                 /* Hit start of new word */
-                argc++;
+                arg_vec[argc++] = dst;
                 skipping = false;
             }
             *dst++ = c;
         }
     }
+    *dst = '\0';
+
+    *argcp = argc;
+    return arg_vec;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int prof_bucket(uint64_t ns)
+{
+    if (ns < PROF_SUB)
+        return (int) ns;
+    int e = 63 - __builtin_clzll(ns);
+    int sub = (int) (ns >> (e - PROF_SUB_BITS)) & (PROF_SUB - 1);
+    return PROF_SUB + (e - PROF_SUB_BITS) * PROF_SUB + sub;
+}
+
+/* Middle of the range of values counted in bucket b */
+static uint64_t prof_bucket_value(int b)
+{
+    if (b < PROF_SUB)
+        return b;
+    int e = (b - PROF_SUB) / PROF_SUB + PROF_SUB_BITS;
+    uint64_t sub = (b - PROF_SUB) % PROF_SUB;
+    uint64_t width = (uint64_t) 1 << (e - PROF_SUB_BITS);
+    return ((PROF_SUB + sub) << (e - PROF_SUB_BITS)) + width / 2;
+}
+
+static void record_latency(cmd_ptr cmd, uint64_t ns)
+{
+    struct cmd_profile *p = cmd->profile;
+    if (!p) {
+        p = calloc_or_fail(1, sizeof(struct cmd_profile), "record_latency");
+        p->min = UINT64_MAX;
+        cmd->profile = p;
+    }
+
+    p->count++;
+    p->total += ns;
+    if (ns < p->min)
+        p->min = ns;
+    if (ns > p->max)
+        p->max = ns;
+    p->buckets[prof_bucket(ns)]++;
+}
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
+/* Latency below which a fraction q of the recorded calls fall */
+static uint64_t prof_quantile(const struct cmd_profile *p, double q)
+{
+    uint64_t rank = (uint64_t) (q * p->count + 0.5);
+    uint64_t seen = 0;
+    if (rank < 1)
+        rank = 1;
+
+    for (int b = 0; b < PROF_BUCKETS; b++) {
+        seen += p->buckets[b];
+        if (seen >= rank) {
+            uint64_t v = prof_bucket_value(b);
+            return v < p->min ? p->min : v > p->max ? p->max : v;
+        }
     }
+    return p->max;
+}
 
-    free_block(buf, len + 1);
-    *argcp = argc;
-    return argv;
+static void show_profile()
+{
+    report(1, "Command latency (microseconds):");
+    report(1, "%-12s %10s %10s %10s %10s %10s %10s", "cmd", "calls", "min",
+           "mean", "p50", "p99", "max");
+    for (cmd_ptr c = cmd_list; c; c = c->next) {
+        const struct cmd_profile *p = c->profile;
+        if (!p)
+            continue;
+        report(1, "%-12s %10lu %10.3f %10.3f %10.3f %10.3f %10.3f", c->name,
+               (unsigned long) p->count, p->min / 1e3,
+               (double) p->total / p->count / 1e3,
+               prof_quantile(p, 0.50) / 1e3, prof_quantile(p, 0.99) / 1e3,
+               p->max / 1e3);
+    }
 }
 
 static void record_error()
@@ -177,12 +370,16 @@ static bool interpret_cmda(int argc, char *argv[])
     if (argc == 0)
         return true;
     /* Try to find matching command */
-    cmd_ptr next_cmd = cmd_list;
+    cmd_ptr next_cmd = find_cmd(argv[0]);
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
     if (next_cmd) {
+        cmd_count++;
+        bool profiling = profile;
+        uint64_t start = profiling ? now_ns() : 0;
         ok = next_cmd->operation(argc, argv);
+        /* After quit, the command list is gone */
+        if (profiling && !quit_flag)
+            record_latency(next_cmd, now_ns() - start);
         if (!ok)
             record_error();
     } else {
@@ -190,27 +387,23 @@ static bool interpret_cmda(int argc, char *argv[])
         record_error();
         ok = false;
     }
+    report_flush();
 
     return ok;
 }
 
-/* Execute a command from a command line */
-static bool interpret_cmd(char *cmdline)
+/* Execute a command from the len characters of a command line */
+static bool interpret_cmd(const char *cmdline, size_t len)
 {
     if (quit_flag)
         return false;
 
 #if RPT >= 6
-    report(6, "Interpreting command '%s'\n", cmdline);
+    report(6, "Interpreting command '%.*s'\n", (int) len, cmdline);
 #endif
     int argc;
-    char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
-
-    return ok;
+    char **argv = parse_args(cmdline, len, &argc);
+    return interpret_cmda(argc, argv);
 }
 
 /* Set function to be executed as part of program exit */
@@ -231,11 +424,16 @@ void set_echo(bool on)
 /* Built-in commands */
 static bool do_quit(int argc, char *argv[])
 {
+    if (profile)
+        show_profile();
+
     cmd_ptr c = cmd_list;
     bool ok = true;
     while (c) {
         cmd_ptr ele = c;
         c = c->next;
+        if (ele->profile)
+            free_block(ele->profile, sizeof(struct cmd_profile));
         free_block(ele, sizeof(cmd_ele));
     }
 
@@ -245,6 +443,8 @@ static bool do_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_ele));
     }
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
 
     while (buf_stack)
         pop_file();
@@ -326,17 +526,13 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_ptr plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
+        param_ptr plist = find_param(name);
+        if (plist) {
+            int oldval = *plist->valp;
+            *plist->valp = value;
+            if (plist->setter)
+                plist->setter(oldval);
+            found = true;
         }
         /* Didn't find parameter */
         if (!found) {
@@ -397,11 +593,77 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+static bool do_profile(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!profile)
+        report(1, "Warning: profiling is off, use 'option profile 1'");
+    show_profile();
+    return true;
+}
+
+/* Run a command which is expected to fail, without counting it as an error */
+static bool do_xfail(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "No command given");
+        return false;
+    }
+
+    cmd_ptr c = find_cmd(argv[1]);
+    if (!c) {
+        report(1, "Unknown command '%s'", argv[1]);
+        return false;
+    }
+    if (c->operation(argc - 1, argv + 1)) {
+        report(1, "ERROR: '%s' was expected to fail", argv[1]);
+        return false;
+    }
+    return true;
+}
+
+/* Port of the listen command when none is given */
+#define DEFAULT_PORT 9999
+
+static bool do_listen(int argc, char *argv[])
+{
+    int port = DEFAULT_PORT;
+    if (argc > 2) {
+        report(1, "%s takes at most one argument", argv[0]);
+        return false;
+    }
+    if (argc == 2 && (!get_int(argv[1], &port) || port < 0 || port > 65535)) {
+        report(1, "Invalid port '%s'", argv[1]);
+        return false;
+    }
+
+    if (server_active()) {
+        report(1, "Already listening on port %d", server_port());
+        return false;
+    }
+    if (!server_open(port)) {
+        report(1, "Could not listen on port %d: %s", port, strerror(errno));
+        return false;
+    }
+
+    /* Input piped in goes on through linenoise, and clients wait for its end */
+    if (isatty(STDIN_FILENO))
+        use_linenoise = false;
+    report(1, "Listening on port %d", server_port());
+    return true;
+}
+
 /* Initialize interpreter */
 void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
     err_cnt = 0;
     quit_flag = false;
 
@@ -411,11 +673,18 @@ void init_cmd()
     ADD_COMMAND(source, " file           | Read commands from source file");
     ADD_COMMAND(log, " file           | Copy output to file");
     ADD_COMMAND(time, " cmd arg ...    | Time command execution");
+    ADD_COMMAND(profile, "                | Show latency of each command");
+    ADD_COMMAND(xfail, " cmd arg ...    | Run command, which must fail");
+    ADD_COMMAND(listen,
+                " [port]         | Accept commands over TCP on localhost");
     add_cmd("#", do_comment_cmd, " ...            | Display comment");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
+    add_param("profile", &profile, "Record latency of every command", NULL);
+    add_param("buffer", &report_buffering,
+              "Buffer output, writing it once per command", NULL);
 
     init_in();
     init_time(&last_time);
@@ -440,6 +709,21 @@ static bool push_file(char *fname)
     rnew->fd = fd;
     rnew->cnt = 0;
     rnew->bufptr = rnew->buf;
+    rnew->map = NULL;
+    rnew->map_len = 0;
+
+    /* Anything that can be mapped is read from the mapping instead */
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            rnew->map = map;
+            rnew->map_len = st.st_size;
+        }
+    }
+    rnew->map_pos = rnew->map;
+
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
@@ -452,6 +736,8 @@ static void pop_file()
     if (buf_stack) {
         rio_ptr rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (rsave->map)
+            munmap(rsave->map, rsave->map_len);
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -463,10 +749,43 @@ static void init_in()
     buf_stack = NULL;
 }
 
+static void echo_line(const char *line, size_t len)
+{
+    if (len > 0 && line[len - 1] == '\n')
+        len--;
+    report_noreturn(1, "%s%.*s\n", prompt, (int) len, line);
+}
+
+/* Take the next line straight out of the mapped file on top of the stack */
+static char *map_readline(size_t *lenp)
+{
+    rio_ptr r = buf_stack;
+    size_t left = r->map + r->map_len - r->map_pos;
+    if (left == 0) {
+        /* Encountered EOF */
+        pop_file();
+        return NULL;
+    }
+
+    char *line = r->map_pos;
+    char *nl = memchr(line, '\n', left);
+    size_t len = nl ? (size_t) (nl - line) + 1 : left;
+    r->map_pos += len;
+
+    if (echo)
+        echo_line(line, len);
+
+    *lenp = len;
+    return line;
+}
+
 /* Read command from input file.
- * When hit EOF, close that file and return NULL
+ * When hit EOF, close that file and return NULL.
+ * Otherwise, set *lenp to the length of the line, including its newline. The
+ * line is not null-terminated when it points into a mapped file.
+ * Lines typed in the terminal are not echoed, as they show already.
  */
-static char *readline()
+static char *readline(size_t *lenp)
 {
     int cnt;
     char c;
@@ -475,6 +794,9 @@ static char *readline()
     if (!buf_stack)
         return NULL;
 
+    if (buf_stack->map)
+        return map_readline(lenp);
+
     for (cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
         if (buf_stack->cnt <= 0) {
             /* Need to read from input file */
@@ -487,11 +809,10 @@ static char *readline()
                     /* Last line of file did not terminate with newline. */
                     /*  Terminate line & return it */
                     *lptr++ = '\n';
-                    *lptr++ = '\0';
-                    if (echo) {
-                        report_noreturn(1, prompt);
-                        report_noreturn(1, linebuf);
-                    }
+                    *lptr = '\0';
+                    *lenp = lptr - linebuf;
+                    if (echo && has_infile)
+                        echo_line(linebuf, *lenp);
                     return linebuf;
                 }
                 return NULL;
@@ -510,19 +831,18 @@ static char *readline()
         /* Hit buffer limit.  Artificially terminate line */
         *lptr++ = '\n';
     }
-    *lptr++ = '\0';
+    *lptr = '\0';
+    *lenp = lptr - linebuf;
 
-    if (echo) {
-        report_noreturn(1, prompt);
-        report_noreturn(1, linebuf);
-    }
+    if (echo && has_infile)
+        echo_line(linebuf, *lenp);
 
     return linebuf;
 }
 
 static bool cmd_done()
 {
-    return !buf_stack || quit_flag;
+    return (!buf_stack && !server_active()) || quit_flag;
 }
 
 /*
@@ -531,6 +851,8 @@ static bool cmd_done()
  * buffer
  * or readable from command input.  If so, that command is executed.
  * Same return as select.  Command input file removed from readfds
+ * The sockets of the listen command are waited on as well, and their commands
+ * run; they are not counted in the return value, nor left in the sets.
  *
  * nfds should be set to the maximum file descriptor for network sockets.
  * If nfds == 0, this indicates that there is no pending network activity
@@ -541,29 +863,40 @@ int cmd_select(int nfds,
                fd_set *exceptfds,
                struct timeval *timeout)
 {
-    int infd;
-    fd_set local_readset;
+    fd_set local_readset, local_writeset;
 
     if (cmd_done())
         return 0;
 
-    if (!block_flag) {
-        /* Process any commands in input buffer */
-        if (!readfds)
-            readfds = &local_readset;
+    if (!readfds) {
+        readfds = &local_readset;
+        FD_ZERO(readfds);
+    }
+    if (!writefds) {
+        writefds = &local_writeset;
+        FD_ZERO(writefds);
+    }
 
+    /* The terminal is left to linenoise, unless listening for clients */
+    bool use_input = !block_flag && buf_stack && (has_infile || !use_linenoise);
+    if (use_input) {
         /* Add input fd to readset for select */
-        infd = buf_stack->fd;
+        int infd = buf_stack->fd;
         FD_SET(infd, readfds);
         if (infd == STDIN_FILENO && prompt_flag) {
+            report_flush();
             printf("%s", prompt);
             fflush(stdout);
-            prompt_flag = true;
+            prompt_flag = false;
         }
 
         if (infd >= nfds)
             nfds = infd + 1;
     }
+
+    int server_nfds = server_fdset(readfds, writefds);
+    if (server_nfds > nfds)
+        nfds = server_nfds;
     if (nfds == 0)
         return 0;
 
@@ -571,18 +904,19 @@ int cmd_select(int nfds,
     if (result <= 0)
         return result;
 
-    infd = buf_stack->fd;
-    if (readfds && FD_ISSET(infd, readfds)) {
+    if (use_input && FD_ISSET(buf_stack->fd, readfds)) {
         /* Commandline input available */
-        FD_CLR(infd, readfds);
+        FD_CLR(buf_stack->fd, readfds);
         result--;
-        if (has_infile) {
-            char *cmdline;
-            cmdline = readline();
-            if (cmdline)
-                interpret_cmd(cmdline);
-        }
+        if (buf_stack->fd == STDIN_FILENO)
+            prompt_flag = true;
+        size_t len;
+        char *cmdline = readline(&len);
+        if (cmdline)
+            interpret_cmd(cmdline, len);
     }
+
+    result -= server_handle(readfds, writefds, interpret_cmd);
     return result;
 }
 
@@ -592,6 +926,9 @@ bool finish_cmd()
     if (!quit_flag)
         ok = ok && do_quit(0, NULL);
     has_infile = false;
+    server_close();
+    release_args();
+    report_flush();
     return ok && err_cnt == 0;
 }
 
@@ -645,16 +982,19 @@ bool run_console(char *infile_name)
 
     if (!has_infile) {
         char *cmdline;
-        while ((cmdline = linenoise(prompt)) != NULL) {
-            interpret_cmd(cmdline);
+        while (use_linenoise && (cmdline = linenoise(prompt)) != NULL) {
+            interpret_cmd(cmdline, strlen(cmdline));
             linenoiseHistoryAdd(cmdline);       /* Add to the history. */
             linenoiseHistorySave(HISTORY_FILE); /* Save the history on disk. */
             linenoiseFree(cmdline);
         }
-    } else {
-        while (!cmd_done())
-            cmd_select(0, NULL, NULL, NULL, NULL);
+        /* Input has ended, so clients are all that can be left to serve */
+        if (use_linenoise && buf_stack && !buf_stack->prev)
+            pop_file();
     }
 
+    while (!cmd_done())
+        cmd_select(0, NULL, NULL, NULL, NULL);
+
     return err_cnt == 0;
 }
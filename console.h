@@ -10,18 +10,27 @@
 /* Simulation flag of console option */
 extern int simulation;
 
+/* Number of commands dispatched so far, the one running included */
+extern unsigned cmd_count;
+
 /* Each command defined in terms of a function */
 typedef bool (*cmd_function)(int argc, char *argv[]);
 
 /* Information about each command */
 
-/* Organized as linked list in alphabetical order */
+/*
+ * Organized as linked list in alphabetical order, for listing.
+ * Also chained into a hash table by name, for dispatch.
+ */
 typedef struct CELE cmd_ele, *cmd_ptr;
 struct CELE {
     char *name;
     cmd_function operation;
     char *documentation;
+    /* Latency statistics, allocated once 'option profile' is turned on */
+    struct cmd_profile *profile;
     cmd_ptr next;
+    cmd_ptr hnext;
 };
 
 /* Optionally supply function that gets invoked when parameter changes */
@@ -36,6 +45,7 @@ struct PELE {
     /* Function that gets called whenever parameter changes */
     setter_function setter;
     param_ptr next;
+    param_ptr hnext;
 };
 
 /* Initialize interpreter */
@@ -0,0 +1,254 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cqueue.h"
+#include "harness.h"
+
+typedef struct cq_node {
+    /* Written under the tail lock while the head lock holder may read it */
+    struct cq_node *next;
+    char value[];
+} cq_node_t;
+
+#define CACHE_LINE 64
+
+/*
+ * The head and the tail are kept on cache lines of their own, so that
+ * producers and consumers do not slow each other down by sharing one.
+ */
+struct cqueue {
+    cq_node_t *head; /* Dummy node, followed by the front of the queue */
+    pthread_mutex_t head_lock;
+    char head_pad[CACHE_LINE];
+    cq_node_t *tail; /* Last node, the dummy one if the queue is empty */
+    pthread_mutex_t tail_lock;
+    char tail_pad[CACHE_LINE];
+    int size;
+};
+
+static inline cq_node_t *next_node(cq_node_t *node)
+{
+    return __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+}
+
+static inline void set_next(cq_node_t *node, cq_node_t *next)
+{
+    __atomic_store_n(&node->next, next, __ATOMIC_RELEASE);
+}
+
+static cq_node_t *new_node(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    cq_node_t *node = malloc(sizeof(cq_node_t) + len);
+    if (!node)
+        return NULL;
+
+    node->next = NULL;
+    memcpy(node->value, s, len);
+    return node;
+}
+
+cqueue_t *cq_new()
+{
+    cqueue_t *q = malloc(sizeof(cqueue_t));
+    if (!q)
+        return NULL;
+
+    q->head = q->tail = new_node("");
+    if (!q->head) {
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->head_lock, NULL);
+    pthread_mutex_init(&q->tail_lock, NULL);
+    q->size = 0;
+    return q;
+}
+
+void cq_free(cqueue_t *q)
+{
+    if (!q)
+        return;
+
+    cq_node_t *node = q->head;
+    while (node) {
+        cq_node_t *next = node->next;
+        free(node);
+        node = next;
+    }
+    pthread_mutex_destroy(&q->head_lock);
+    pthread_mutex_destroy(&q->tail_lock);
+    free(q);
+}
+
+bool cq_insert_tail(cqueue_t *q, const char *s)
+{
+    if (!q)
+        return false;
+
+    cq_node_t *node = new_node(s);
+    if (!node)
+        return false;
+
+    /* Counted first, so that the size never drops below zero */
+    __atomic_fetch_add(&q->size, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&q->tail_lock);
+    set_next(q->tail, node);
+    q->tail = node;
+    pthread_mutex_unlock(&q->tail_lock);
+    return true;
+}
+
+bool cq_insert_head(cqueue_t *q, const char *s)
+{
+    if (!q)
+        return false;
+
+    cq_node_t *node = new_node(s);
+    if (!node)
+        return false;
+
+    __atomic_fetch_add(&q->size, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&q->head_lock);
+    if (!next_node(q->head)) {
+        /* Empty: the new node becomes the tail as well, unless a producer
+         * got in first
+         */
+        pthread_mutex_lock(&q->tail_lock);
+        bool empty = !q->head->next;
+        if (empty) {
+            set_next(q->head, node);
+            q->tail = node;
+        }
+        pthread_mutex_unlock(&q->tail_lock);
+        if (empty) {
+            pthread_mutex_unlock(&q->head_lock);
+            return true;
+        }
+    }
+
+    /* Not empty, so producers only ever touch nodes behind this one */
+    node->next = q->head->next;
+    set_next(q->head, node);
+    pthread_mutex_unlock(&q->head_lock);
+    return true;
+}
+
+bool cq_remove_head(cqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q)
+        return false;
+
+    pthread_mutex_lock(&q->head_lock);
+    cq_node_t *dummy = q->head;
+    cq_node_t *first = next_node(dummy);
+    if (!first) {
+        pthread_mutex_unlock(&q->head_lock);
+        return false;
+    }
+
+    if (sp) {
+        strncpy(sp, first->value, bufsize - 1);
+        sp[bufsize - 1] = '\0';
+    }
+    /* The first node takes over as the dummy one */
+    q->head = first;
+    pthread_mutex_unlock(&q->head_lock);
+
+    /* Not the tail, hence out of reach of the producers */
+    free(dummy);
+    __atomic_fetch_sub(&q->size, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+int cq_size(cqueue_t *q)
+{
+    if (!q)
+        return 0;
+
+    return __atomic_load_n(&q->size, __ATOMIC_RELAXED);
+}
+
+/* Wait until no other operation is in progress, and keep new ones waiting */
+static void quiesce(cqueue_t *q)
+{
+    pthread_mutex_lock(&q->head_lock);
+    pthread_mutex_lock(&q->tail_lock);
+}
+
+static void resume(cqueue_t *q)
+{
+    pthread_mutex_unlock(&q->tail_lock);
+    pthread_mutex_unlock(&q->head_lock);
+}
+
+void cq_reverse(cqueue_t *q)
+{
+    if (!q)
+        return;
+
+    quiesce(q);
+    cq_node_t *cur = q->head->next, *prev = NULL;
+    if (cur)
+        q->tail = cur;
+    while (cur) {
+        cq_node_t *next = cur->next;
+        cur->next = prev;
+        prev = cur;
+        cur = next;
+    }
+    q->head->next = prev;
+    resume(q);
+}
+
+/* Merge two sorted NULL-terminated chains, a first on ties */
+static cq_node_t *merge_nodes(cq_node_t *a, cq_node_t *b)
+{
+    cq_node_t *head = NULL, **tail = &head;
+
+    while (a && b) {
+        cq_node_t **min = strcmp(a->value, b->value) <= 0 ? &a : &b;
+        *tail = *min;
+        tail = &(*min)->next;
+        *min = (*min)->next;
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+void cq_sort(cqueue_t *q)
+{
+    if (!q)
+        return;
+
+    quiesce(q);
+
+    /* Bottom-up merge sort: pending[i] is a sorted run of 2^i nodes */
+    cq_node_t *pending[64] = {NULL};
+    cq_node_t *list = q->head->next;
+    while (list) {
+        cq_node_t *run = list;
+        list = list->next;
+        run->next = NULL;
+
+        int i = 0;
+        for (; pending[i]; i++) {
+            run = merge_nodes(pending[i], run);
+            pending[i] = NULL;
+        }
+        pending[i] = run;
+    }
+
+    /* Higher runs hold earlier nodes, so they go first on ties */
+    for (int i = 0; i < 64; i++) {
+        if (pending[i])
+            list = list ? merge_nodes(pending[i], list) : pending[i];
+    }
+
+    q->head->next = list;
+    q->tail = q->head;
+    while (q->tail->next)
+        q->tail = q->tail->next;
+    resume(q);
+}
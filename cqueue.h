@@ -0,0 +1,67 @@
+#ifndef LAB0_CQUEUE_H
+#define LAB0_CQUEUE_H
+
+/*
+ * Queue of strings that several threads may operate on at the same time.
+ *
+ * This is the two-lock queue of Michael and Scott, from "Simple, Fast, and
+ * Practical Non-Blocking and Blocking Concurrent Queue Algorithms" (1996): a
+ * singly-linked list behind a dummy node, whose head and tail are guarded by
+ * locks of their own. Producers at the tail and consumers at the head do not
+ * wait for each other, only for other threads working at the same end.
+ *
+ * Operations walking the whole queue, such as sorting, first take both locks,
+ * which waits for every operation in progress to finish and keeps new ones
+ * off until they are done.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct cqueue cqueue_t;
+
+/*
+ * Create empty queue.
+ * Return NULL if could not allocate space.
+ */
+cqueue_t *cq_new();
+
+/*
+ * Free all storage used by queue. No effect if q is NULL.
+ * No other thread may be using the queue any more.
+ */
+void cq_free(cqueue_t *q);
+
+/*
+ * Attempt to insert a copy of s at head, or at tail, of queue.
+ * Return false if q is NULL or could not allocate space.
+ * Insertion at head takes the tail lock too when the queue is empty.
+ */
+bool cq_insert_head(cqueue_t *q, const char *s);
+bool cq_insert_tail(cqueue_t *q, const char *s);
+
+/*
+ * Attempt to remove the element at head of queue.
+ * Return false if q is NULL or empty.
+ * If sp is non-NULL, copy the removed string to *sp (up to a maximum of
+ * bufsize-1 characters, plus a null terminator.)
+ * There is no removal at tail, which would have to walk the whole queue.
+ */
+bool cq_remove_head(cqueue_t *q, char *sp, size_t bufsize);
+
+/*
+ * Return number of elements in queue, 0 if q is NULL.
+ * While other threads insert and remove, this is only a snapshot.
+ */
+int cq_size(cqueue_t *q);
+
+/* Reverse elements in queue, stopping all other operations meanwhile */
+void cq_reverse(cqueue_t *q);
+
+/*
+ * Sort elements of queue in ascending order, stopping all other operations
+ * meanwhile. The sort is stable.
+ */
+void cq_sort(cqueue_t *q);
+
+#endif /* LAB0_CQUEUE_H */
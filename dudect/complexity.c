@@ -0,0 +1,210 @@
+/** How does the running time of a queue operation grow?
+ *
+ * This complements the constant time test of fixture.c for operations whose
+ * cost is expected to depend on the queue length. The operation is timed
+ * with cpucycles() on queues of SCALE_MIN << k random strings, keeping the
+ * fastest of SCALE_RUNS runs for every size. These times are then fitted by
+ * least squares to t = c * f(n) for each model f, and the model with the
+ * smallest relative RMS error is the best fit.
+ *
+ * Notes:
+ *
+ *  - the models are far apart over a 32-fold range of sizes, so the outcome
+ *    does not depend on how fast the machine is, unlike a wall-clock limit.
+ *
+ *  - interruptions only ever add time, hence the fastest run is the least
+ *    disturbed one.
+ *
+ *  - the largest queue is kept small enough to stay in the cache. Beyond
+ *    that, every node visited costs a cache miss, and the jump in cost per
+ *    node would look like a higher order of growth. Even so, a linear walk
+ *    gets slightly slower per node as the queue grows, so an operation also
+ *    passes when its bound still fits within SCALE_TOLERANCE.
+ */
+
+#include "complexity.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../queue.h"
+#include "../random.h"
+#include "cpucycles.h"
+
+#define SCALE_MIN 128
+#define SCALE_STEPS 6
+#define SCALE_RUNS 7
+#define SCALE_STRLEN 8
+
+/* Largest relative RMS error at which a model still explains the timings */
+#define SCALE_TOLERANCE 0.2
+
+enum { model_1, model_n, model_nlogn, model_n2, nr_models };
+
+static const char *model_names[nr_models] = {"O(1)", "O(n)", "O(n log n)",
+                                             "O(n^2)"};
+
+enum {
+    scale_sort,
+    scale_reverse,
+    scale_size,
+    scale_delete_mid,
+    scale_delete_dup,
+    scale_delete_dup_unsorted,
+    scale_swap,
+};
+
+static double model_value(int model, double n)
+{
+    switch (model) {
+    case model_1:
+        return 1;
+    case model_n:
+        return n;
+    case model_nlogn:
+        return n * log2(n);
+    default:
+        return n * n;
+    }
+}
+
+/* Relative RMS error of the least squares fit of t = c * f(n) */
+static double fit_error(const double *n, const double *t, int model)
+{
+    double ff = 0, tf = 0, mean = 0;
+    for (int k = 0; k < SCALE_STEPS; k++) {
+        double f = model_value(model, n[k]);
+        ff += f * f;
+        tf += t[k] * f;
+        mean += t[k];
+    }
+    mean /= SCALE_STEPS;
+
+    double c = tf / ff, sq = 0;
+    for (int k = 0; k < SCALE_STEPS; k++) {
+        double d = t[k] - c * model_value(model, n[k]);
+        sq += d * d;
+    }
+    return sqrt(sq / SCALE_STEPS) / mean;
+}
+
+static struct list_head *build_queue(int n)
+{
+    struct list_head *l = q_new();
+    char s[SCALE_STRLEN + 1];
+    s[SCALE_STRLEN] = '\0';
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < SCALE_STRLEN; j++)
+            s[j] = 'a' + prng_range(26);
+        q_insert_tail(l, s);
+    }
+    return l;
+}
+
+static int64_t measure_op(int op, struct list_head *l)
+{
+    int64_t before = cpucycles();
+    switch (op) {
+    case scale_sort:
+        q_sort(l);
+        break;
+    case scale_reverse:
+        q_reverse(l);
+        break;
+    case scale_size:
+        q_size(l);
+        break;
+    case scale_delete_mid:
+        q_delete_mid(l);
+        break;
+    case scale_delete_dup:
+        q_delete_dup(l);
+        break;
+    case scale_delete_dup_unsorted:
+        q_delete_dup_unsorted(l);
+        break;
+    default:
+        q_swap(l);
+    }
+    return cpucycles_end() - before;
+}
+
+static bool test_scaling(char *text, int op, int bound)
+{
+    double n[SCALE_STEPS], t[SCALE_STEPS];
+
+    printf("Testing %s...\n", text);
+    for (int k = 0; k < SCALE_STEPS; k++) {
+        int64_t fastest = INT64_MAX;
+        for (int r = 0; r < SCALE_RUNS; r++) {
+            struct list_head *l = build_queue(SCALE_MIN << k);
+            int64_t ticks = measure_op(op, l);
+            if (ticks < fastest)
+                fastest = ticks;
+            q_free(l);
+        }
+
+        n[k] = SCALE_MIN << k;
+        t[k] = fastest;
+        printf("n = %7.0f: %12.0f cycles\n", n[k], t[k]);
+    }
+
+    double err[nr_models];
+    int best = 0;
+    for (int m = 0; m < nr_models; m++) {
+        err[m] = fit_error(n, t, m);
+        if (err[m] < err[best])
+            best = m;
+    }
+    int second = best == 0 ? 1 : 0;
+    for (int m = 0; m < nr_models; m++) {
+        if (m != best && err[m] < err[second])
+            second = m;
+    }
+
+    printf("fit error:");
+    for (int m = 0; m < nr_models; m++)
+        printf(" %s %.3f%s", model_names[m], err[m],
+               m + 1 < nr_models ? "," : "\n");
+    /* How much better the best model does than the runner-up */
+    double confidence = err[second] > 0 ? 1 - err[best] / err[second] : 0;
+    printf("best fit: %s, confidence %.0f%%\n", model_names[best],
+           100 * confidence);
+
+    return best <= bound || err[bound] <= SCALE_TOLERANCE;
+}
+
+bool is_sort_nlogn(void)
+{
+    return test_scaling("sort", scale_sort, model_nlogn);
+}
+
+bool is_reverse_linear(void)
+{
+    return test_scaling("reverse", scale_reverse, model_n);
+}
+
+bool is_size_const(void)
+{
+    return test_scaling("size", scale_size, model_1);
+}
+
+bool is_delete_mid_linear(void)
+{
+    return test_scaling("delete_mid", scale_delete_mid, model_n);
+}
+
+bool is_delete_dup_linear(void)
+{
+    return test_scaling("delete_dup", scale_delete_dup, model_n);
+}
+
+bool is_delete_dup_unsorted_linear(void)
+{
+    return test_scaling("delete_dup_unsorted", scale_delete_dup_unsorted,
+                        model_n);
+}
+
+bool is_swap_linear(void)
+{
+    return test_scaling("swap", scale_swap, model_n);
+}
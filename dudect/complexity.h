@@ -0,0 +1,20 @@
+#ifndef DUDECT_COMPLEXITY_H
+#define DUDECT_COMPLEXITY_H
+
+#include <stdbool.h>
+
+/*
+ * Interface to test how the running time of a queue operation grows.
+ * Each function times its operation on queues of geometrically increasing
+ * size, fits the measurements against O(1), O(n), O(n log n) and O(n^2), and
+ * returns whether the operation is no worse than the bound in its name.
+ */
+bool is_sort_nlogn(void);
+bool is_reverse_linear(void);
+bool is_size_const(void);
+bool is_delete_mid_linear(void);
+bool is_delete_dup_linear(void);
+bool is_delete_dup_unsorted_linear(void);
+bool is_swap_linear(void);
+
+#endif
@@ -49,7 +49,7 @@ char *get_random_string(void)
 
 void prepare_inputs(uint8_t *input_data, uint8_t *classes)
 {
-    randombytes(input_data, n_measure * chunk_size);
+    prng_fill(input_data, n_measure * chunk_size);
     for (size_t i = 0; i < n_measure; i++) {
         classes[i] = randombit();
         if (classes[i] == 0)
@@ -58,7 +58,7 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
 
     for (size_t i = 0; i < N_MEASURE; ++i) {
         /* Generate random string */
-        randombytes((uint8_t *) random_string[i], 7);
+        prng_fill((uint8_t *) random_string[i], 7);
         random_string[i][7] = 0;
     }
 }
@@ -81,7 +81,7 @@ void measure(int64_t *before_ticks,
                 *(uint16_t *) (input_data + i * chunk_size) % 10000);
             before_ticks[i] = cpucycles();
             dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             dut_free();
         }
         break;
@@ -94,7 +94,7 @@ void measure(int64_t *before_ticks,
                 *(uint16_t *) (input_data + i * chunk_size) % 10000);
             before_ticks[i] = cpucycles();
             dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             dut_free();
         }
         break;
@@ -106,7 +106,7 @@ void measure(int64_t *before_ticks,
                 *(uint16_t *) (input_data + i * chunk_size) % 10000);
             before_ticks[i] = cpucycles();
             element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             if (e)
                 q_release_element(e);
             dut_free();
@@ -120,7 +120,7 @@ void measure(int64_t *before_ticks,
                 *(uint16_t *) (input_data + i * chunk_size) % 10000);
             before_ticks[i] = cpucycles();
             element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             if (e)
                 q_release_element(e);
             dut_free();
@@ -134,7 +134,7 @@ void measure(int64_t *before_ticks,
                 *(uint16_t *) (input_data + i * chunk_size) % 10000);
             before_ticks[i] = cpucycles();
             dut_size(1);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             dut_free();
         }
     }
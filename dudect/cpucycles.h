@@ -1,10 +1,17 @@
 #include <stdint.h>
 // http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
+
+/*
+ * Read the cycle counter at the start of a measurement.
+ * The reading waits for all earlier instructions to complete, so none of the
+ * setup is counted, and none of the measured code starts before it.
+ */
 static inline int64_t cpucycles(void)
 {
 #if defined(__i386__) || defined(__x86_64__)
     unsigned int hi, lo;
-    __asm__ volatile("rdtsc\n\t" : "=a"(lo), "=d"(hi));
+    __asm__ volatile("lfence\n\trdtsc\n\tlfence"
+                     : "=a"(lo), "=d"(hi)::"memory");
     return ((int64_t) lo) | (((int64_t) hi) << 32);
 
 #elif defined(__aarch64__)
@@ -15,7 +22,29 @@ static inline int64_t cpucycles(void)
      * bits wide and it is attributed with the flag 'cap_user_time_short'
      * is true.
      */
-    asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+    asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(val)::"memory");
+    return val;
+#else
+#error Unsupported Architecture
+#endif
+}
+
+/*
+ * Read the cycle counter at the end of a measurement.
+ * rdtscp only reads once the measured code has completed, and the fence
+ * keeps whatever follows from being started before the reading.
+ */
+static inline int64_t cpucycles_end(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo, aux;
+    __asm__ volatile("rdtscp\n\tlfence"
+                     : "=a"(lo), "=d"(hi), "=c"(aux)::"memory");
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+
+#elif defined(__aarch64__)
+    uint64_t val;
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(val)::"memory");
     return val;
 #else
 #error Unsupported Architecture
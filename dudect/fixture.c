@@ -7,32 +7,44 @@
  *
  * Notes:
  *
- *  - the execution time distribution tends to be skewed towards large
- *    timings, leading to a fat right tail. Most executions take little time,
- *    some of them take a lot. We try to speed up the test process by
- *    throwing away those measurements with large cycle count. (For example,
- *    those measurements could correspond to the execution being interrupted
- *    by the OS.) Setting a threshold value for this is not obvious; we just
- *    keep the x% percent fastest timings, and repeat for several values of x.
+ *  - the verdict rests on a single t-test over the raw measurements. Tests
+ *    on measurements cropped at several percentiles, and a second order
+ *    test, were tried and dropped: they are sensitive enough to pick up the
+ *    timer itself getting slower once a large queue has been built (an
+ *    empty timed region goes from about 60 to about 110 cycles on some
+ *    machines, and subtracting a baseline reading taken right before each
+ *    measurement does not cancel it), which fails every operation.
  *
- *  - the previous observation is highly heuristic. We also keep the uncropped
- *    measurement time and do a t-test on that.
+ *  - both cycle counter readings are serialized (see cpucycles.h), so that
+ *    neither the setup nor the code following the measured call leaks into
+ *    a measurement.
  *
- *  - we also test for unequal variances (second order test), but this is
- *    probably redundant since we're doing as well a t-test on cropped
- *    measurements (non-linear transform)
+ *  - measurements can optionally be pinned to one CPU (option pin), so that
+ *    all readings come from the same cycle counter and no run is migrated to
+ *    another CPU midway.
  *
- *  - as long as any of the different test fails, the code will be deemed
- *    variable time.
+ *  - the batches of a try can be spread over several processes (option
+ *    workers). Each of them measures with its own copy of the queue and of
+ *    the t-test, and the copies are merged with Chan's formula. The t-test
+ *    only keeps the count, mean and sum of squared deviations of each
+ *    class, and these merge exactly up to rounding. The result is thus the
+ *    one a single process measuring the same samples would get. A test
+ *    depending on earlier measurements, such as a second order test centred
+ *    on a running mean, would not merge this way.
  */
 
+#define _GNU_SOURCE /* sched_setaffinity */
 #include "fixture.h"
 #include <assert.h>
 #include <math.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "../console.h"
 #include "../random.h"
 #include "constant.h"
@@ -40,12 +52,19 @@
 
 #define enough_measure 10000
 #define test_tries 10
+#define max_workers 64
+
+/* Batches of n_measure measurements needed for one try */
+#define number_batches (enough_measure / (n_measure - drop_size * 2) + 1)
 
 extern const int drop_size;
 extern const size_t chunk_size;
 extern const size_t n_measure;
 static t_ctx *t;
 
+int dudect_cpu = -1;
+int dudect_workers = 1;
+
 /* threshold values for Welch's t-test */
 enum {
     t_threshold_bananas = 500, /* Test failed with overwhelming probability */
@@ -81,14 +100,14 @@ static void update_statistics(const int64_t *exec_times, uint8_t *classes)
 static bool report(void)
 {
     double max_t = fabs(t_compute(t));
-    double number_traces_max_t = t->n[0] + t->n[1];
-    double max_tau = max_t / sqrt(number_traces_max_t);
+    double number_traces = t->n[0] + t->n[1];
+    double max_tau = max_t / sqrt(number_traces);
 
     printf("\033[A\033[2K");
-    printf("meas: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < enough_measure) {
+    printf("meas: %7.2lf M, ", (number_traces / 1e6));
+    if (number_traces < enough_measure) {
         printf("not enough measurements (%.0f still to go).\n",
-               enough_measure - number_traces_max_t);
+               enough_measure - number_traces);
         return false;
     }
 
@@ -117,7 +136,8 @@ static bool report(void)
     return true;
 }
 
-static bool doit(int mode)
+/* Measure one batch and add it to the t-test */
+static void measure_batch(int mode)
 {
     int64_t *before_ticks = calloc(n_measure + 1, sizeof(int64_t));
     int64_t *after_ticks = calloc(n_measure + 1, sizeof(int64_t));
@@ -135,15 +155,18 @@ static bool doit(int mode)
     measure(before_ticks, after_ticks, input_data, mode);
     differentiate(exec_times, before_ticks, after_ticks);
     update_statistics(exec_times, classes);
-    bool ret = report();
 
     free(before_ticks);
     free(after_ticks);
     free(exec_times);
     free(classes);
     free(input_data);
+}
 
-    return ret;
+static bool doit(int mode)
+{
+    measure_batch(mode);
+    return report();
 }
 
 static void init_once(void)
@@ -152,21 +175,165 @@ static void init_once(void)
     t_init(t);
 }
 
+#ifdef __linux__
+static cpu_set_t saved_cpus;
+
+static bool set_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        printf("Could not pin measurements to CPU %d\n", cpu);
+        return false;
+    }
+    return true;
+}
+
+/* Move onto dudect_cpu, if set. Return true if the affinity was changed */
+static bool pin_cpu(void)
+{
+    if (dudect_cpu < 0 ||
+        sched_getaffinity(0, sizeof(saved_cpus), &saved_cpus) != 0)
+        return false;
+    return set_cpu(dudect_cpu);
+}
+
+static void unpin_cpu(void)
+{
+    sched_setaffinity(0, sizeof(saved_cpus), &saved_cpus);
+}
+#else
+static bool pin_cpu(void)
+{
+    if (dudect_cpu >= 0)
+        printf("Pinning to a CPU is not supported on this system\n");
+    return false;
+}
+
+static void unpin_cpu(void) {}
+
+static bool set_cpu(int cpu)
+{
+    (void) cpu;
+    return false;
+}
+#endif
+
+/*
+ * Body of worker w: measure nbatches batches into a fresh t-test, then send
+ * it through fd. Never returns.
+ */
+static void __attribute__((noreturn))
+run_worker(int w, int nbatches, int mode, int fd)
+{
+    /* A crash must end this process, not resume qtest in it */
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGALRM, SIG_DFL);
+
+    /* Otherwise every worker would draw the same inputs */
+    prng_seed(prng_next() + (uint64_t) w);
+    if (dudect_cpu >= 0)
+        set_cpu(dudect_cpu + w);
+
+    t_init(t);
+    for (int i = 0; i < nbatches; i++)
+        measure_batch(mode);
+
+    size_t len = sizeof(t_ctx), done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, (char *) t + done, len - done);
+        if (n <= 0)
+            _exit(1);
+        done += (size_t) n;
+    }
+    _exit(0);
+}
+
+/* Receive the t-test of a worker and merge it into ours */
+static bool collect_worker(int fd)
+{
+    t_ctx other;
+    size_t len = sizeof(t_ctx), done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (char *) &other + done, len - done);
+        if (n <= 0)
+            return false;
+        done += (size_t) n;
+    }
+    t_merge(t, &other);
+    return true;
+}
+
+/* One try, with its batches spread over dudect_workers processes */
+static bool run_workers(int mode)
+{
+    int nworkers = dudect_workers < max_workers ? dudect_workers : max_workers;
+    pid_t pid[max_workers];
+    int fd[max_workers];
+
+    int nbatches = number_batches;
+    fflush(stdout);
+    for (int w = 0; w < nworkers; w++) {
+        int share = nbatches / nworkers + (w < nbatches % nworkers);
+        int p[2];
+        pid[w] = -1;
+        fd[w] = -1;
+        if (pipe(p) != 0)
+            p[0] = p[1] = -1;
+        else if ((pid[w] = fork()) == 0) {
+            close(p[0]);
+            run_worker(w, share, mode, p[1]);
+        }
+        if (p[1] >= 0)
+            close(p[1]);
+        if (pid[w] > 0) {
+            fd[w] = p[0];
+            continue;
+        }
+
+        /* No process for this share, measure it here */
+        if (p[0] >= 0)
+            close(p[0]);
+        for (int i = 0; i < share; i++)
+            measure_batch(mode);
+    }
+
+    for (int w = 0; w < nworkers; w++) {
+        if (pid[w] <= 0)
+            continue;
+        if (!collect_worker(fd[w]))
+            printf("Measurement worker %d failed\n\n", w);
+        close(fd[w]);
+        waitpid(pid[w], NULL, 0);
+    }
+
+    return report();
+}
+
 static bool TEST_CONST(char *text, int mode)
 {
     bool result = false;
     t = malloc(sizeof(t_ctx));
+    if (!t)
+        die();
+    bool pinned = pin_cpu();
 
     for (int cnt = 0; cnt < test_tries; ++cnt) {
         printf("Testing %s...(%d/%d)\n\n", text, cnt, test_tries);
         init_once();
-        for (int i = 0; i < enough_measure / (n_measure - drop_size * 2) + 1;
-             ++i)
-            result = doit(mode);
+        if (dudect_workers > 1)
+            result = run_workers(mode);
+        else {
+            for (int i = 0; i < number_batches; ++i)
+                result = doit(mode);
+        }
         printf("\033[A\033[2K\033[A\033[2K");
         if (result == true)
             break;
     }
+    if (pinned)
+        unpin_cpu();
     free(t);
     return result;
 }
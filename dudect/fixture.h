@@ -4,6 +4,14 @@
 #include <stdbool.h>
 #include "constant.h"
 
+/* CPU to run the measurements on, or -1 to leave that to the scheduler */
+extern int dudect_cpu;
+
+/* Processes to spread the measurements over, 1 to measure in qtest itself.
+ * When pinning, worker i runs on CPU dudect_cpu + i.
+ */
+extern int dudect_workers;
+
 /* Interface to test if function is constant */
 bool is_insert_head_const(void);
 bool is_insert_tail_const(void);
@@ -48,3 +48,20 @@ void t_init(t_ctx *ctx)
     }
     return;
 }
+
+/* Fold the measurements of src into dst, as if they had been pushed there.
+ * This is the parallel variant of Welford's method by Chan et al.
+ */
+void t_merge(t_ctx *dst, const t_ctx *src)
+{
+    for (int class = 0; class < 2; class ++) {
+        double n = dst->n[class] + src->n[class];
+        if (n == 0)
+            continue;
+        double delta = src->mean[class] - dst->mean[class];
+        dst->mean[class] += delta * src->n[class] / n;
+        dst->m2[class] += src->m2[class] +
+                          delta * delta * dst->n[class] * src->n[class] / n;
+        dst->n[class] = n;
+    }
+}
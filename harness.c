@@ -1,12 +1,15 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "random.h"
 #include "report.h"
 
 /* Our program needs to use regular malloc/free */
@@ -29,20 +32,57 @@
 
 /* Data structures used by our code */
 
-/*
- * Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
- */
+/* Header placed in front of every allocated block */
 typedef struct BELE {
-    struct BELE *next, *prev;
     size_t payload_size;
     size_t magic_header; /* Marker to see if block seems legitimate */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_ele_t;
 
-static block_ele_t *allocated = NULL;
-static size_t allocated_count = 0;
+/*
+ * Set of allocated blocks, as an open-addressing hash table keyed by block
+ * address with linear probing. Empty slots hold NULL. The table is kept at
+ * most half full, so finding, adding and removing a block all take constant
+ * expected time no matter how many blocks are live.
+ */
+#define LIVE_MIN_CAPACITY 1024
+
+#ifndef HARNESS_PERF
+static block_ele_t **live_table = NULL;
+static size_t live_count = 0;
+#endif
+static size_t live_capacity = 0; /* Always a power of 2 */
+
+/* Taken around every use of the live-block table in threaded mode */
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool threaded_mode = false;
+
+/*
+ * Allocation statistics, shown by show_meminfo().
+ * Size class c counts requests of 2^(c-1) + 1 up to 2^c bytes.
+ * Each thread counts into a set of its own, which only it updates. Blocks
+ * may be freed by another thread than the one allocating them, so some
+ * counts of a set can drop below zero and wrap around; only sums matter.
+ */
+#define NR_SIZE_CLASSES 64
+struct harness_stats {
+    size_t allocated_count;
+    size_t class_allocs[NR_SIZE_CLASSES];
+    size_t class_frees[NR_SIZE_CLASSES];
+    size_t live_bytes;
+    size_t peak_bytes;
+};
+
+static harness_stats_t main_stats;
+static __thread harness_stats_t *stats = &main_stats;
+
+/* Bytes the harness adds to every block */
+#ifdef HARNESS_PERF
+#define BLOCK_OVERHEAD sizeof(size_t)
+#else
+#define BLOCK_OVERHEAD (sizeof(block_ele_t) + sizeof(size_t))
+#endif
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
@@ -68,8 +108,86 @@ static bool time_limited = false;
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    return fail_probability > 0 &&
+           prng_range(100) < (uint32_t) fail_probability;
+}
+
+#ifndef HARNESS_PERF
+
+static inline size_t live_hash(const block_ele_t *b)
+{
+    /* Fibonacci hashing; the low bits of a block address carry no entropy */
+    uint64_t h = (uint64_t) (uintptr_t) b * 0x9E3779B97F4A7C15ULL;
+    return (size_t) (h >> 32) & (live_capacity - 1);
+}
+
+/* Return slot holding b, or the empty slot where it would go */
+static size_t live_slot(const block_ele_t *b)
+{
+    size_t i = live_hash(b);
+    while (live_table[i] && live_table[i] != b)
+        i = (i + 1) & (live_capacity - 1);
+    return i;
+}
+
+static void live_grow()
+{
+    block_ele_t **old_table = live_table;
+    size_t old_capacity = live_capacity;
+
+    live_capacity = old_capacity ? old_capacity * 2 : LIVE_MIN_CAPACITY;
+    live_table = calloc(live_capacity, sizeof(block_ele_t *));
+    if (!live_table) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        return;
+    }
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_table[i])
+            live_table[live_slot(old_table[i])] = old_table[i];
+    }
+    free(old_table);
+}
+
+static void live_add(block_ele_t *b)
+{
+    if (2 * (live_count + 1) > live_capacity)
+        live_grow();
+    live_table[live_slot(b)] = b;
+    live_count++;
+}
+
+static bool live_contains(const block_ele_t *b)
+{
+    return live_capacity && live_table[live_slot(b)] == b;
+}
+
+/*
+ * Remove b from the set, if present.
+ * Entries following it in the same probe sequence are shifted back, so the
+ * table never needs tombstones.
+ */
+static void live_remove(const block_ele_t *b)
+{
+    if (!live_contains(b))
+        return;
+
+    size_t mask = live_capacity - 1;
+    size_t hole = live_slot(b);
+    size_t i = hole;
+    for (;;) {
+        i = (i + 1) & mask;
+        if (!live_table[i])
+            break;
+        /* Move the entry into the hole unless its home lies in (hole, i] */
+        size_t home = live_hash(live_table[i]);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            live_table[hole] = live_table[i];
+            hole = i;
+        }
+    }
+    live_table[hole] = NULL;
+    live_count--;
 }
 
 /*
@@ -86,13 +204,7 @@ static block_ele_t *find_header(void *p)
     block_ele_t *b = (block_ele_t *) ((size_t) p - sizeof(block_ele_t));
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_ele_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+        if (!live_contains(b)) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
@@ -111,6 +223,92 @@ static block_ele_t *find_header(void *p)
     return b;
 }
 
+#endif /* !HARNESS_PERF */
+
+static inline int size_class(size_t size)
+{
+    return size <= 1 ? 0 : 64 - __builtin_clzll((unsigned long long) size - 1);
+}
+
+static void account_alloc(size_t size)
+{
+    stats->allocated_count++;
+    stats->class_allocs[size_class(size)]++;
+    stats->live_bytes += size;
+    if (stats->live_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes;
+}
+
+static void account_free(size_t size)
+{
+    stats->allocated_count--;
+    stats->class_frees[size_class(size)]++;
+    stats->live_bytes -= size;
+}
+
+static inline void lock_live(void)
+{
+    if (threaded_mode)
+        pthread_mutex_lock(&live_lock);
+}
+
+static inline void unlock_live(void)
+{
+    if (threaded_mode)
+        pthread_mutex_unlock(&live_lock);
+}
+
+/*
+ * Implementation of application functions
+ */
+
+#ifdef HARNESS_PERF
+
+/*
+ * Thin version of the allocation functions, for measuring performance.
+ * Each block only carries its size in front, so the statistics stay exact.
+ */
+void *test_malloc(size_t size)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to malloc disallowed");
+        return NULL;
+    }
+
+    if (fail_allocation()) {
+        report_event(MSG_WARN, "Malloc returning NULL");
+        return NULL;
+    }
+
+    size_t *new_block = malloc(sizeof(size_t) + size);
+    if (!new_block) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        error_occurred = true;
+        return NULL;
+    }
+
+    *new_block = size;
+    account_alloc(size);
+    return new_block + 1;
+}
+
+void test_free(void *p)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to free disallowed");
+        return;
+    }
+
+    if (!p)
+        return;
+
+    size_t *b = (size_t *) p - 1;
+    account_free(*b);
+    free(b);
+}
+
+#else /* !HARNESS_PERF */
+
 /* Given pointer to block, find its footer */
 static size_t *find_footer(block_ele_t *b)
 {
@@ -119,9 +317,6 @@ static size_t *find_footer(block_ele_t *b)
     return p;
 }
 
-/*
- * Implementation of application functions
- */
 void *test_malloc(size_t size)
 {
     if (noallocate_mode) {
@@ -148,15 +343,10 @@ void *test_malloc(size_t size)
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    lock_live();
+    live_add(new_block);
+    unlock_live();
+    account_alloc(size);
 
     return p;
 }
@@ -183,6 +373,7 @@ void test_free(void *p)
     if (!p)
         return;
 
+    lock_live();
     block_ele_t *b = find_header(p);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
@@ -196,20 +387,14 @@ void test_free(void *p)
     *find_footer(b) = MAGICFREE;
     memset(p, FILLCHAR, b->payload_size);
 
-    /* Unlink from list */
-    block_ele_t *bn = b->next;
-    block_ele_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
-
+    live_remove(b);
+    unlock_live();
+    account_free(b->payload_size);
     free(b);
-    allocated_count--;
 }
 
+#endif /* HARNESS_PERF */
+
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
@@ -223,7 +408,45 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    return main_stats.allocated_count;
+}
+
+void show_meminfo(int vlevel, size_t nelem)
+{
+    size_t *class_allocs = main_stats.class_allocs;
+    size_t *class_frees = main_stats.class_frees;
+    size_t allocated_count = main_stats.allocated_count;
+    size_t live_bytes = main_stats.live_bytes;
+    size_t peak_bytes = main_stats.peak_bytes;
+
+    size_t allocs = 0, frees = 0;
+    for (int c = 0; c < NR_SIZE_CLASSES; c++) {
+        allocs += class_allocs[c];
+        frees += class_frees[c];
+    }
+
+    size_t block_bytes = allocated_count * BLOCK_OVERHEAD;
+    size_t table_bytes = live_capacity * sizeof(block_ele_t *);
+    report(vlevel, "Blocks: %lu allocated, %lu freed, %lu live", allocs, frees,
+           allocated_count);
+    report(vlevel, "Payload bytes: %lu live, %lu peak", live_bytes,
+           peak_bytes);
+    report(vlevel,
+           "Harness overhead bytes: %lu headers/footers, %lu live-block table",
+           block_bytes, table_bytes);
+    if (nelem > 0) {
+        report(vlevel,
+               "Bytes per element: %.1f payload, %.1f including overhead",
+               (double) live_bytes / nelem,
+               (double) (live_bytes + block_bytes) / nelem);
+    }
+
+    report(vlevel, "%12s %12s %12s", "size <=", "allocs", "frees");
+    for (int c = 0; c < NR_SIZE_CLASSES; c++) {
+        if (class_allocs[c] || class_frees[c])
+            report(vlevel, "%12lu %12lu %12lu", (unsigned long) 1 << c,
+                   class_allocs[c], class_frees[c]);
+    }
 }
 
 /*
@@ -239,6 +462,38 @@ void set_cautious_mode(bool cautious)
     cautious_mode = cautious;
 }
 
+void set_threaded_mode(bool threaded)
+{
+    threaded_mode = threaded;
+}
+
+harness_stats_t *harness_thread_begin()
+{
+    harness_stats_t *s = calloc(1, sizeof(harness_stats_t));
+    if (!s) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        return NULL;
+    }
+    stats = s;
+    return s;
+}
+
+void harness_thread_end(harness_stats_t *s)
+{
+    if (!s)
+        return;
+
+    main_stats.allocated_count += s->allocated_count;
+    for (int c = 0; c < NR_SIZE_CLASSES; c++) {
+        main_stats.class_allocs[c] += s->class_allocs[c];
+        main_stats.class_frees[c] += s->class_frees[c];
+    }
+    main_stats.live_bytes += s->live_bytes;
+    if (main_stats.live_bytes > main_stats.peak_bytes)
+        main_stats.peak_bytes = main_stats.live_bytes;
+    free(s);
+}
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
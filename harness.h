@@ -9,6 +9,12 @@
  * This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
  * allow checking for common allocation errors.
+ *
+ * When built with HARNESS_PERF defined, as for qtest-perf, the checks are
+ * left out: blocks get no magic words or fill pattern and are only counted,
+ * not tracked one by one. Freeing a block that is not allocated then goes
+ * undetected. Malloc failure injection, the restricted allocation mode, the
+ * time limit and the statistics work the same in both builds.
  */
 
 void *test_malloc(size_t size);
@@ -22,6 +28,13 @@ char *test_strdup(const char *s);
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/*
+ * Show allocations and frees per power-of-two size class, live and peak bytes,
+ * and the bytes the harness spends on top of them. If nelem is non-zero, also
+ * show the live bytes per queue element.
+ */
+void show_meminfo(int vlevel, size_t nelem);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
@@ -31,6 +44,22 @@ extern int fail_probability;
  */
 void set_cautious_mode(bool cautious);
 
+/*
+ * Support for code under test running in several threads at once.
+ * In threaded mode, the set of allocated blocks is locked around each use.
+ * A thread other than the main one calls harness_thread_begin() before it
+ * allocates, so that it counts into statistics of its own. Once the thread
+ * has been joined, the main thread adds them to its own and releases them
+ * with harness_thread_end(). allocation_check() and show_meminfo() only see
+ * the main thread's statistics, so threads show up after they are ended.
+ * Malloc failure injection and the restricted allocation mode are not
+ * thread-safe, and should be left off while threads allocate.
+ */
+typedef struct harness_stats harness_stats_t;
+void set_threaded_mode(bool threaded);
+harness_stats_t *harness_thread_begin();
+void harness_thread_end(harness_stats_t *s);
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
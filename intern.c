@@ -0,0 +1,134 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "intern.h"
+
+/* Every interned string sits at the end of one of these */
+typedef struct entry {
+    struct entry *next; /* Next entry in the same bucket */
+    size_t refs;
+    size_t len;
+    uint64_t hash;
+    char str[];
+} entry_t;
+
+#define MIN_BUCKETS 64
+
+static struct {
+    entry_t **buckets; /* Power-of-two sized, NULL while nothing is interned */
+    size_t nbuckets;
+    size_t count;
+} table;
+
+/* 64-bit FNV-1a */
+static uint64_t hash_string(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static inline entry_t **bucket(uint64_t hash)
+{
+    return &table.buckets[hash & (table.nbuckets - 1)];
+}
+
+/* Move every entry into a table of n buckets. Return false if out of memory */
+static bool rehash(size_t n)
+{
+    entry_t **buckets = malloc(n * sizeof(entry_t *));
+    if (!buckets)
+        return false;
+    memset(buckets, 0, n * sizeof(entry_t *));
+
+    for (size_t i = 0; i < table.nbuckets; i++) {
+        entry_t *e = table.buckets[i];
+        while (e) {
+            entry_t *next = e->next;
+            entry_t **b = &buckets[e->hash & (n - 1)];
+            e->next = *b;
+            *b = e;
+            e = next;
+        }
+    }
+    free(table.buckets);
+    table.buckets = buckets;
+    table.nbuckets = n;
+    return true;
+}
+
+char *intern_get(const char *s, size_t len)
+{
+    uint64_t hash = hash_string(s, len);
+    if (table.buckets) {
+        for (entry_t *e = *bucket(hash); e; e = e->next) {
+            if (e->hash == hash && e->len == len && !memcmp(e->str, s, len)) {
+                e->refs++;
+                return e->str;
+            }
+        }
+    }
+
+    /* Keep at most one string per bucket on average. Longer chains will do
+     * if the table cannot grow, but there has to be one.
+     */
+    if (table.count >= table.nbuckets &&
+        !rehash(table.nbuckets ? 2 * table.nbuckets : MIN_BUCKETS) &&
+        !table.buckets)
+        return NULL;
+
+    entry_t *e = malloc(sizeof(entry_t) + len + 1);
+    if (!e) {
+        if (!table.count) {
+            free(table.buckets);
+            table.buckets = NULL;
+            table.nbuckets = 0;
+        }
+        return NULL;
+    }
+    e->refs = 1;
+    e->len = len;
+    e->hash = hash;
+    memcpy(e->str, s, len);
+    e->str[len] = '\0';
+
+    entry_t **b = bucket(hash);
+    e->next = *b;
+    *b = e;
+    table.count++;
+    return e->str;
+}
+
+void intern_put(char *s)
+{
+    if (!s)
+        return;
+
+    entry_t *e = (entry_t *) (s - offsetof(entry_t, str));
+    if (--e->refs)
+        return;
+
+    entry_t **p = bucket(e->hash);
+    while (*p != e)
+        p = &(*p)->next;
+    *p = e->next;
+    free(e);
+
+    if (--table.count == 0) {
+        free(table.buckets);
+        table.buckets = NULL;
+        table.nbuckets = 0;
+    }
+}
+
+size_t intern_count(void)
+{
+    return table.count;
+}
@@ -0,0 +1,32 @@
+#ifndef LAB0_INTERN_H
+#define LAB0_INTERN_H
+
+/*
+ * Reference-counted table of interned strings.
+ *
+ * Every distinct string is stored once, in a block of its own found through
+ * a chained hash table, and carries the number of references handed out for
+ * it. Equal strings interned at the same time thus share one address, so
+ * they compare equal by pointer. The block goes away with its last
+ * reference, and the table itself once no string is left, so that nothing
+ * shows up in allocation_check() after every reference has been dropped.
+ *
+ * There is a single table for all queues, which is not thread-safe.
+ */
+
+#include <stddef.h>
+
+/*
+ * Take a reference to the interned copy of the len bytes long string s,
+ * interning it first if needed. The copy must not be modified.
+ * Return NULL if could not allocate space.
+ */
+char *intern_get(const char *s, size_t len);
+
+/* Drop a reference taken by intern_get(). No effect if s is NULL */
+void intern_put(char *s);
+
+/* Number of distinct strings currently interned */
+size_t intern_count(void);
+
+#endif /* LAB0_INTERN_H */
@@ -0,0 +1,166 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "harness.h"
+#include "pool.h"
+
+/* Every slab starts with this header, its objects follow */
+struct slab {
+    struct slab *next;
+    /* Class the objects belong to, used to find the freelist on release */
+    pool_class_t *cls;
+};
+
+/*
+ * Word placed right in front of every object handed out.
+ * It points to the slab holding the object, or is NULL for large objects.
+ */
+typedef struct {
+    struct slab *slab;
+} obj_header_t;
+
+/* Layout of an object too large for any class */
+struct big {
+    struct list_head link;
+    obj_header_t header;
+};
+
+/* Freelist node, stored in the payload of a released object */
+struct free_obj {
+    struct free_obj *next;
+};
+
+void pool_init(pool_t *pool)
+{
+    for (int i = 0; i < POOL_NR_CLASSES; i++) {
+        pool_class_t *cls = &pool->classes[i];
+        cls->obj_size = (size_t) 1 << (POOL_MIN_SHIFT + i);
+        cls->freelist = NULL;
+        cls->current = NULL;
+        cls->cursor = cls->end = NULL;
+    }
+    pool->slabs = NULL;
+    INIT_LIST_HEAD(&pool->big);
+}
+
+/* Find the smallest class able to hold size bytes plus the header */
+static int size_to_class(size_t size)
+{
+    size_t need = size + sizeof(obj_header_t);
+    int shift = POOL_MIN_SHIFT;
+    while (shift <= POOL_MAX_SHIFT && ((size_t) 1 << shift) < need)
+        shift++;
+    return shift - POOL_MIN_SHIFT;
+}
+
+/* Get a fresh slab for cls. Return false if could not allocate space */
+static bool grow_class(pool_t *pool, pool_class_t *cls)
+{
+    struct slab *s = malloc(POOL_SLAB_SIZE);
+    if (!s)
+        return false;
+
+    s->cls = cls;
+    s->next = pool->slabs;
+    pool->slabs = s;
+    cls->current = s;
+
+    size_t nobjs = (POOL_SLAB_SIZE - sizeof(struct slab)) / cls->obj_size;
+    cls->cursor = (char *) (s + 1);
+    cls->end = cls->cursor + nobjs * cls->obj_size;
+    return true;
+}
+
+static void *big_alloc(pool_t *pool, size_t size)
+{
+    struct big *b = malloc(sizeof(struct big) + size);
+    if (!b)
+        return NULL;
+
+    b->header.slab = NULL;
+    list_add(&b->link, &pool->big);
+    return b + 1;
+}
+
+void *pool_alloc(pool_t *pool, size_t size)
+{
+    int c = size_to_class(size);
+    if (c >= POOL_NR_CLASSES)
+        return big_alloc(pool, size);
+
+    pool_class_t *cls = &pool->classes[c];
+    if (cls->freelist) {
+        struct free_obj *obj = cls->freelist;
+        cls->freelist = obj->next;
+        return obj;
+    }
+
+    if (cls->cursor == cls->end && !grow_class(pool, cls))
+        return NULL;
+
+    obj_header_t *h = (obj_header_t *) cls->cursor;
+    cls->cursor += cls->obj_size;
+    h->slab = cls->current;
+    return h + 1;
+}
+
+void pool_free(void *p)
+{
+    if (!p)
+        return;
+
+    obj_header_t *h = (obj_header_t *) p - 1;
+    if (!h->slab) {
+        struct big *b = container_of(h, struct big, header);
+        list_del(&b->link);
+        free(b);
+        return;
+    }
+
+    pool_class_t *cls = h->slab->cls;
+    struct free_obj *obj = p;
+    obj->next = cls->freelist;
+    cls->freelist = obj;
+}
+
+void pool_adopt(pool_t *pool, pool_t *from)
+{
+    struct slab *s = from->slabs;
+    while (s) {
+        struct slab *next = s->next;
+        s->cls = &pool->classes[s->cls - from->classes];
+        s->next = pool->slabs;
+        pool->slabs = s;
+        s = next;
+    }
+
+    /* The never used ends of the newest slabs of from are left unused */
+    for (int i = 0; i < POOL_NR_CLASSES; i++) {
+        struct free_obj *obj = from->classes[i].freelist;
+        while (obj) {
+            struct free_obj *next = obj->next;
+            obj->next = pool->classes[i].freelist;
+            pool->classes[i].freelist = obj;
+            obj = next;
+        }
+    }
+
+    list_splice_init(&from->big, &pool->big);
+    pool_init(from);
+}
+
+void pool_destroy(pool_t *pool)
+{
+    struct slab *s = pool->slabs;
+    while (s) {
+        struct slab *next = s->next;
+        free(s);
+        s = next;
+    }
+
+    struct list_head *cur, *safe;
+    list_for_each_safe (cur, safe, &pool->big)
+        free(list_entry(cur, struct big, link));
+
+    pool_init(pool);
+}
@@ -0,0 +1,69 @@
+#ifndef LAB0_POOL_H
+#define LAB0_POOL_H
+
+/*
+ * Slab allocator for queue elements and their strings.
+ *
+ * Objects are carved out of slabs taken from malloc, grouped by power-of-two
+ * size classes. A released object goes on the freelist of its class and is
+ * handed out again by the next allocation of that class. Requests larger than
+ * the biggest class fall back to one malloc each, but are still tracked by the
+ * pool, so pool_destroy() can release everything in O(number of slabs).
+ *
+ * Slabs come from the harness malloc like any other block. Hence they show up
+ * in allocation_check() until the pool owning them is destroyed.
+ */
+
+#include <stddef.h>
+#include "list.h"
+
+/* Size classes, including the per-object header: 32 bytes to 1 KiB */
+#define POOL_MIN_SHIFT 5
+#define POOL_MAX_SHIFT 10
+#define POOL_NR_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+/* Bytes requested from malloc for each slab */
+#define POOL_SLAB_SIZE 16384
+
+struct slab;
+
+typedef struct {
+    size_t obj_size;
+    void *freelist;        /* Released objects, linked through their payload */
+    struct slab *current;  /* Newest slab of this class */
+    char *cursor, *end;    /* Never used part of the newest slab */
+} pool_class_t;
+
+typedef struct pool {
+    pool_class_t classes[POOL_NR_CLASSES];
+    struct slab *slabs;    /* All slabs owned by this pool */
+    struct list_head big;  /* Objects too large for any class */
+} pool_t;
+
+/* Prepare an empty pool. No memory is allocated until first use */
+void pool_init(pool_t *pool);
+
+/*
+ * Allocate size bytes from pool.
+ * Return NULL if could not allocate space.
+ */
+void *pool_alloc(pool_t *pool, size_t size);
+
+/* Give back an object obtained from pool_alloc() to the pool owning it */
+void pool_free(void *p);
+
+/*
+ * Make pool the owner of every slab and large object of from, which is left
+ * empty. Objects of from handed out so far are then given back to pool, and
+ * released along with it. Takes time linear in the number of slabs and of
+ * released objects of from.
+ */
+void pool_adopt(pool_t *pool, pool_t *from);
+
+/*
+ * Release every slab and large object of pool at once.
+ * Objects that have not been given back become invalid as well.
+ */
+void pool_destroy(pool_t *pool);
+
+#endif /* LAB0_POOL_H */
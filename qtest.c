@@ -1,19 +1,26 @@
 /* Implementation of testing code for queue code */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
-#include <time.h>
 #include <unistd.h>
+#include "dudect/complexity.h"
 #include "dudect/fixture.h"
 #include "list.h"
+#include "random.h"
 
 /* Our program needs to use regular malloc/free */
 #define INTERNAL 1
@@ -34,6 +41,7 @@
 #include "queue.h"
 
 #include "console.h"
+#include "cqueue.h"
 #include "report.h"
 
 /* Settable parameters */
@@ -43,11 +51,28 @@
 /*
  * How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST 30
 static int big_list_size = BIG_LIST;
 
+/*
+ * How much of the queue gets verified after each command.
+ * Full walks every node. Ends only checks the big_list_size nodes next to
+ * each end, where most operations do their work, so its cost does not grow
+ * with the queue. Sampled does full checks during every verify_period-th
+ * command and checks the ends otherwise.
+ */
+#define VERIFY_FULL 0
+#define VERIFY_SAMPLED 1
+#define VERIFY_ENDS 2
+static int verify_policy = VERIFY_FULL;
+static int verify_period = 100;
+
+/* Threads sort runs with, q_sort_parallel() is used when more than one */
+static int sort_threads = 1;
+
+/* Non-zero: dedup keeps the queue order, with q_delete_dup_unsorted() */
+static int dedup_unsorted = 0;
 
 /* Global variables */
 
@@ -63,6 +88,24 @@ static list_head_meta_t l_meta;
 /* Number of elements in queue */
 static size_t lcnt = 0;
 
+/*
+ * Chain of queues
+ * new adds a queue behind the current one and makes it current, prev and
+ * next move along the chain, and free makes the queue in front of the freed
+ * one current. Other commands work on the current queue, which is tracked
+ * in l_meta and lcnt; its entry is brought up to date before another queue
+ * becomes current, or the chain is handed to q_merge().
+ */
+typedef struct {
+    queue_context_t ctx;
+    list_head_meta_t meta;
+    size_t cnt;
+} queue_entry_t;
+
+static LIST_HEAD(queues);
+static queue_entry_t *current = NULL;
+static int next_queue_id = 0;
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_LIST;
 static int fail_count = 0;
@@ -71,11 +114,56 @@ static int string_length = MAXSTRING;
 
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
+
+/*
+ * Repetition count from which ih/it go through the bulk insertion API,
+ * and how many elements are inserted, then checked, per batch.
+ * Malloc failure injection keeps the per-element path, which counts every
+ * failed insertion separately.
+ */
+#define BULK_MIN 64
+#define BULK_BATCH 1024
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 
+/* Seed of the random generator, 0 until set by 'option seed' */
+static int seed = 0;
+
 /* Forward declarations */
 static bool show_queue(int vlevel);
 
+static void save_current()
+{
+    if (current) {
+        current->meta = l_meta;
+        current->cnt = lcnt;
+    }
+}
+
+/* Make e the current queue, or none if e is NULL, without saving the old */
+static void load_current(queue_entry_t *e)
+{
+    current = e;
+    if (e) {
+        l_meta = e->meta;
+        lcnt = e->cnt;
+    } else {
+        l_meta.l = NULL;
+        l_meta.size = 0;
+        lcnt = 0;
+    }
+}
+
+/* Number of elements in all queues */
+static size_t chain_cnt()
+{
+    save_current();
+    size_t cnt = 0;
+    queue_entry_t *e;
+    list_for_each_entry (e, &queues, ctx.chain)
+        cnt += e->cnt;
+    return cnt;
+}
+
 static bool do_free(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -88,19 +176,27 @@ static bool do_free(int argc, char *argv[])
         report(3, "Warning: Calling free on null queue");
     error_check();
 
-    if (lcnt > big_list_size)
-        set_cautious_mode(false);
     if (exception_setup(true))
         q_free(l_meta.l);
     exception_cancel();
-    set_cautious_mode(true);
 
-    l_meta.size = 0;
-    l_meta.l = NULL;
-    lcnt = 0;
+    queue_entry_t *next = NULL;
+    if (current) {
+        struct list_head *node = current->ctx.chain.prev;
+        if (node == &queues)
+            node = current->ctx.chain.next;
+        if (node != &queues)
+            next = list_entry(node, queue_entry_t, ctx.chain);
+        list_del(&current->ctx.chain);
+        free(current);
+    }
+    load_current(next);
+    if (next)
+        report(3, "Queue %d is current", next->ctx.id);
     show_queue(3);
 
-    size_t bcnt = allocation_check();
+    /* Blocks of the other queues are still in use */
+    size_t bcnt = list_empty(&queues) ? allocation_check() : 0;
     if (bcnt > 0) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
                bcnt);
@@ -117,22 +213,62 @@ static bool do_new(int argc, char *argv[])
         return false;
     }
 
-    bool ok = true;
-    if (l_meta.l) {
-        report(3, "Freeing old queue");
-        ok = do_free(argc, argv);
+    queue_entry_t *e = malloc(sizeof(queue_entry_t));
+    if (!e) {
+        report(1, "ERROR: Could not allocate entry of new queue");
+        return false;
     }
     error_check();
 
-    if (exception_setup(true)) {
-        l_meta.l = q_new();
-        l_meta.size = 0;
-    }
+    e->ctx.q = NULL;
+    if (exception_setup(true))
+        e->ctx.q = q_new();
     exception_cancel();
-    lcnt = 0;
+    e->ctx.id = next_queue_id++;
+    e->meta.l = e->ctx.q;
+    e->meta.size = 0;
+    e->cnt = 0;
+
+    list_add(&e->ctx.chain, current ? &current->ctx.chain : queues.prev);
+    save_current();
+    load_current(e);
+    report(3, "Queue %d is current", e->ctx.id);
     show_queue(3);
 
-    return ok && !error_check();
+    return !error_check();
+}
+
+/* Make the queue after, or before, the current one current */
+static bool switch_queue(int argc, char *argv[], bool forward)
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (!current) {
+        report(3, "Warning: Calling %s without any queue", argv[0]);
+        return true;
+    }
+
+    struct list_head *node =
+        forward ? current->ctx.chain.next : current->ctx.chain.prev;
+    if (node == &queues)
+        node = forward ? node->next : node->prev;
+    save_current();
+    load_current(list_entry(node, queue_entry_t, ctx.chain));
+    report(3, "Queue %d is current", current->ctx.id);
+    show_queue(3);
+    return true;
+}
+
+static bool do_next(int argc, char *argv[])
+{
+    return switch_queue(argc, argv, true);
+}
+
+static bool do_prev(int argc, char *argv[])
+{
+    return switch_queue(argc, argv, false);
 }
 
 /*
@@ -141,16 +277,103 @@ static bool do_new(int argc, char *argv[])
  */
 static void fill_rand_string(char *buf, size_t buf_size)
 {
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
+    size_t len = MIN_RANDSTR_LEN + prng_range(buf_size - MIN_RANDSTR_LEN);
 
     for (size_t n = 0; n < len; n++) {
-        buf[n] = charset[rand() % (sizeof charset - 1)];
+        buf[n] = charset[prng_range(sizeof charset - 1)];
     }
     buf[len] = '\0';
 }
 
+/*
+ * Insert reps copies of inserts, or random strings if need_rand is set, with
+ * q_insert_head_bulk() or q_insert_tail_bulk(). The queue is checked once per
+ * batch, on the element just inserted at the end that was operated on.
+ */
+static bool insert_bulk(bool tail, char *inserts, bool need_rand, int reps)
+{
+    static char randstr_bufs[BULK_BATCH][MAX_RANDSTR_LEN];
+    char *strs[BULK_BATCH];
+    bool ok = true;
+
+    for (int done = 0; ok && done < reps;) {
+        int n = reps - done < BULK_BATCH ? reps - done : BULK_BATCH;
+        for (int i = 0; i < n; i++) {
+            if (need_rand) {
+                fill_rand_string(randstr_bufs[i], MAX_RANDSTR_LEN);
+                strs[i] = randstr_bufs[i];
+            } else {
+                strs[i] = inserts;
+            }
+        }
+
+        bool rval = tail ? q_insert_tail_bulk(l_meta.l, strs, n)
+                         : q_insert_head_bulk(l_meta.l, strs, n);
+        if (rval) {
+            lcnt += n;
+            l_meta.size += n;
+            struct list_head *last =
+                tail ? q_last(l_meta.l) : q_first(l_meta.l);
+            struct list_head *prev =
+                tail ? q_prev(l_meta.l, last) : q_next(l_meta.l, last);
+            char *cur_inserts = list_entry(last, element_t, list)->value;
+            if (!cur_inserts) {
+                report(1, "ERROR: Failed to save copy of string in queue");
+                ok = false;
+            } else if (cur_inserts == strs[n - 1]) {
+                report(1,
+                       "ERROR: Need to allocate and copy string for new "
+                       "queue element");
+                ok = false;
+            } else if (n > 1 && !q_intern_value &&
+                       cur_inserts == list_entry(prev, element_t, list)->value) {
+                report(1,
+                       "ERROR: Need to allocate separate string for each "
+                       "queue element");
+                ok = false;
+            }
+        } else {
+            fail_count++;
+            if (fail_count < fail_limit)
+                report(2, "Insertion of %d elements failed", n);
+            else {
+                report(1,
+                       "ERROR: Insertion of %d elements failed (%d failures "
+                       "total)",
+                       n, fail_count);
+                ok = false;
+            }
+        }
+        ok = ok && !error_check();
+        done += n;
+    }
+
+    return ok;
+}
+
+/*
+ * In simulation mode, check that the running time of an operation grows no
+ * faster than bound
+ */
+static bool simulate_scaling(int argc,
+                             char *argv[],
+                             bool (*test)(void),
+                             char *bound)
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+    /* dudect prints its progress directly to stdout */
+    report_flush();
+    if (!test()) {
+        report(1, "ERROR: Probably slower than %s", bound);
+        return false;
+    }
+    report(1, "Probably within %s", bound);
+    return true;
+}
+
 /* insert head */
 static bool do_ih(int argc, char *argv[])
 {
@@ -159,6 +382,8 @@ static bool do_ih(int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
+        /* dudect prints its progress directly to stdout */
+        report_flush();
         bool ok = is_insert_head_const();
         if (!ok) {
             report(1, "ERROR: Probably not constant time");
@@ -194,6 +419,15 @@ static bool do_ih(int argc, char *argv[])
         report(3, "Warning: Calling insert head on null queue");
     error_check();
 
+    if (reps >= BULK_MIN && !fail_probability) {
+        if (exception_setup(true))
+            ok = insert_bulk(false, argv[1], need_rand, reps);
+        exception_cancel();
+
+        show_queue(3);
+        return ok;
+    }
+
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
@@ -203,7 +437,7 @@ static bool do_ih(int argc, char *argv[])
                 lcnt++;
                 l_meta.size++;
                 char *cur_inserts =
-                    list_entry(l_meta.l->next, element_t, list)->value;
+                    list_entry(q_first(l_meta.l), element_t, list)->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
                     ok = false;
@@ -213,7 +447,7 @@ static bool do_ih(int argc, char *argv[])
                            "queue element");
                     ok = false;
                     break;
-                } else if (r == 1 && lasts == cur_inserts) {
+                } else if (r == 1 && !q_intern_value && lasts == cur_inserts) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "queue element");
@@ -249,6 +483,8 @@ static bool do_it(int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
+        /* dudect prints its progress directly to stdout */
+        report_flush();
         bool ok = is_insert_tail_const();
         if (!ok) {
             report(1, "ERROR: Probably not constant time");
@@ -283,6 +519,15 @@ static bool do_it(int argc, char *argv[])
         report(3, "Warning: Calling insert tail on null queue");
     error_check();
 
+    if (reps >= BULK_MIN && !fail_probability) {
+        if (exception_setup(true))
+            ok = insert_bulk(true, argv[1], need_rand, reps);
+        exception_cancel();
+
+        show_queue(3);
+        return ok;
+    }
+
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
@@ -292,7 +537,7 @@ static bool do_it(int argc, char *argv[])
                 lcnt++;
                 l_meta.size++;
                 char *cur_inserts =
-                    list_entry(l_meta.l->prev, element_t, list)->value;
+                    list_entry(q_last(l_meta.l), element_t, list)->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
                     ok = false;
@@ -316,6 +561,64 @@ static bool do_it(int argc, char *argv[])
     return ok;
 }
 
+/*
+ * Remove reps elements at once with q_remove_head_n() or q_remove_tail_n().
+ * If expected is not NULL, every removed value must be equal to it.
+ */
+static bool remove_batch(int option, char *expected, int reps)
+{
+    if (!l_meta.size)
+        report(3, "Warning: Calling remove %s on empty queue",
+               option ? "tail" : "head");
+    error_check();
+
+    LIST_HEAD(removed);
+    int cnt = 0;
+    if (exception_setup(true))
+        cnt = option ? q_remove_tail_n(l_meta.l, &removed, reps)
+                     : q_remove_head_n(l_meta.l, &removed, reps);
+    exception_cancel();
+
+    bool ok = true;
+    int detached = 0;
+    element_t *e, *safe;
+    list_for_each_entry_safe (e, safe, &removed, list) {
+        if (ok && expected && strcmp(e->value, expected)) {
+            report(1, "ERROR: Removed value %s != expected value %s", e->value,
+                   expected);
+            ok = false;
+        }
+        detached++;
+        q_release_element(e);
+    }
+    lcnt -= detached;
+    l_meta.size -= detached;
+
+    if (detached != cnt) {
+        report(1, "ERROR: Reported %d removed elements, but %d were detached",
+               cnt, detached);
+        ok = false;
+    }
+
+    if (cnt < reps) {
+        fail_count++;
+        if (!expected && fail_count < fail_limit) {
+            report(2, "Removal of %d elements failed, removed %d", reps, cnt);
+        } else {
+            report(1,
+                   "ERROR: Removal of %d elements failed, removed %d (%d "
+                   "failures total)",
+                   reps, cnt, fail_count);
+            ok = false;
+        }
+    } else {
+        report(2, "Removed %d elements from queue", cnt);
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
 static bool do_remove(int option, int argc, char *argv[])
 {
     // option 0 is for remove head; option 1 is for remove tail
@@ -330,6 +633,8 @@ static bool do_remove(int option, int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
+        /* dudect prints its progress directly to stdout */
+        report_flush();
         bool ok = option ? is_remove_tail_const() : is_remove_head_const();
         if (!ok) {
             report(1, "ERROR: Probably not constant time");
@@ -340,8 +645,19 @@ static bool do_remove(int option, int argc, char *argv[])
     }
 #endif
 
+    if (argc == 3) {
+        int reps;
+        if (!get_int(argv[2], &reps) || reps < 1) {
+            report(1, "Invalid number of removals '%s'", argv[2]);
+            return false;
+        }
+        /* With "-" in place of str, the removed values are not compared */
+        char *expected = strcmp(argv[1], "-") ? argv[1] : NULL;
+        return remove_batch(option, expected, reps);
+    }
+
     if (argc != 1 && argc != 2) {
-        report(1, "%s needs 0-1 arguments", argv[0]);
+        report(1, "%s needs 0-2 arguments", argv[0]);
         return false;
     }
 
@@ -372,7 +688,8 @@ static bool do_remove(int option, int argc, char *argv[])
     removes[string_length + STRINGPAD] = '\0';
 
     if (!l_meta.size)
-        report(3, "Warning: Calling remove head on empty queue");
+        report(3, "Warning: Calling remove %s on empty queue",
+               option ? "tail" : "head");
     error_check();
 
     element_t *re = NULL;
@@ -448,8 +765,17 @@ static inline bool do_rt(int argc, char *argv[])
 /* remove head quietly */
 static bool do_rhq(int argc, char *argv[])
 {
+    if (argc == 2) {
+        int reps;
+        if (!get_int(argv[1], &reps) || reps < 1) {
+            report(1, "Invalid number of removals '%s'", argv[1]);
+            return false;
+        }
+        return remove_batch(0, NULL, reps);
+    }
+
     if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+        report(1, "%s needs 0-1 arguments", argv[0]);
         return false;
     }
 
@@ -486,13 +812,140 @@ static bool do_rhq(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Element of the queue, and its position in it */
+typedef struct {
+    element_t *e;
+    size_t pos;
+} dedup_item_t;
+
+static int cmp_dedup_item(const void *a, const void *b)
+{
+    const dedup_item_t *x = a, *y = b;
+    int cmp = strcmp(x->e->value, y->e->value);
+    if (cmp)
+        return cmp;
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/*
+ * Check q_delete_dup_unsorted() against the result expected from sorting a
+ * copy of the queue: the elements of distinct strings must remain, in order.
+ * The elements are only compared by address, so that elements wrongly
+ * released are not read.
+ */
+static bool dedup_unsorted_checked()
+{
+    size_t n = 0;
+    element_t *item;
+    if (l_meta.l) {
+        q_for_each_entry (item, l_meta.l)
+            n++;
+    }
+
+    dedup_item_t *items = malloc(sizeof(dedup_item_t) * (n ? n : 1));
+    element_t **expect = malloc(sizeof(element_t *) * (n ? n : 1));
+    if (!items || !expect) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for duplicate "
+               "checking");
+        free(items);
+        free(expect);
+        return false;
+    }
+
+    size_t pos = 0;
+    if (l_meta.l) {
+        q_for_each_entry (item, l_meta.l) {
+            items[pos].e = item;
+            items[pos].pos = pos;
+            pos++;
+        }
+    }
+    qsort(items, n, sizeof(dedup_item_t), cmp_dedup_item);
+
+    /* Mark duplicates by clearing their slot of expect */
+    for (size_t i = 0; i < n; i++)
+        expect[items[i].pos] = items[i].e;
+    for (size_t i = 0, j; i < n; i = j) {
+        for (j = i + 1;
+             j < n && !strcmp(items[i].e->value, items[j].e->value); j++)
+            ;
+        if (j - i > 1) {
+            for (size_t k = i; k < j; k++)
+                expect[items[k].pos] = NULL;
+        }
+    }
+    free(items);
+
+    bool ok = true;
+    if (exception_setup(true))
+        ok = q_delete_dup_unsorted(l_meta.l);
+    exception_cancel();
+
+    if (!ok) {
+        free(expect);
+        if (!l_meta.l) {
+            report(1, "ERROR: Calling delete duplicate on null queue");
+            return false;
+        }
+        /* Out of memory for the table, the queue is left as it was */
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Deletion of duplicates failed");
+            return !error_check();
+        }
+        report(1, "ERROR: Deletion of duplicates failed (%d failures total)",
+               fail_count);
+        return false;
+    }
+
+    size_t remain = 0, i = 0;
+    q_for_each_entry (item, l_meta.l) {
+        while (i < n && !expect[i])
+            i++;
+        if (i == n || item != expect[i]) {
+            report(1, "ERROR: Remaining elements are not the distinct "
+                      "strings in queue order");
+            ok = false;
+            break;
+        }
+        i++;
+        remain++;
+    }
+    if (ok) {
+        while (i < n && !expect[i])
+            i++;
+        if (i < n) {
+            report(1, "ERROR: Distinct string deleted from queue");
+            ok = false;
+        }
+    }
+    free(expect);
+
+    if (ok) {
+        lcnt = remain;
+        l_meta.size = remain;
+    }
+    show_queue(3);
+    return ok && !error_check();
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_scaling(argc, argv,
+                                dedup_unsorted ? is_delete_dup_unsorted_linear
+                                               : is_delete_dup_linear,
+                                "O(n)");
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
+    if (dedup_unsorted)
+        return dedup_unsorted_checked();
+
     // establish checking list dup_value
     struct list_head *dup_value = malloc(sizeof(*dup_value));
     if (!dup_value) {
@@ -506,11 +959,12 @@ static bool do_dedup(int argc, char *argv[])
     if (l_meta.l && !list_empty(l_meta.l)) {
         bool last_dup = false;
 
-        list_for_each_entry (item, l_meta.l, list) {
+        q_for_each_entry (item, l_meta.l) {
             element_t *next_item;
-            if (item->list.next == l_meta.l)
+            if (q_next(l_meta.l, &item->list) == l_meta.l)
                 break;
-            next_item = list_entry(item->list.next, element_t, list);
+            next_item =
+                list_entry(q_next(l_meta.l, &item->list), element_t, list);
 
             // assume queue has been sorted
             bool match = !strcmp(item->value, next_item->value);
@@ -592,7 +1046,7 @@ static bool do_dedup(int argc, char *argv[])
     // on the queue after call of q_dedup, return false.
     if (l_meta.size && !list_empty(dup_value)) {
         element_t *next_dup = list_first_entry(dup_value, element_t, list);
-        list_for_each_entry (item, l_meta.l, list) {
+        q_for_each_entry (item, l_meta.l) {
             int cmp = strcmp(item->value, next_dup->value);
 
             // assume queue has been sorted
@@ -628,6 +1082,9 @@ static bool do_dedup(int argc, char *argv[])
 
 static bool do_reverse(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_scaling(argc, argv, is_reverse_linear, "O(n)");
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -649,6 +1106,9 @@ static bool do_reverse(int argc, char *argv[])
 
 static bool do_size(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_scaling(argc, argv, is_size_const, "O(1)");
+
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
@@ -696,8 +1156,63 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/*
+ * Whether checks should cover the whole queue. Decided per command, so that
+ * all the checks of one command agree.
+ */
+static bool verify_whole_queue()
+{
+    if (verify_policy == VERIFY_FULL)
+        return true;
+    if (verify_policy == VERIFY_SAMPLED && verify_period > 0)
+        return cmd_count % verify_period == 0;
+    return false;
+}
+
+/*
+ * Check that the up to n - 1 pairs of adjacent elements starting at from,
+ * going forward or backward in queue order, are in ascending order
+ */
+static bool pairs_sorted(struct list_head *from, bool forward, int n)
+{
+    struct list_head *cur = from;
+    while (cur != l_meta.l && --n > 0) {
+        struct list_head *nxt =
+            forward ? q_next(l_meta.l, cur) : q_prev(l_meta.l, cur);
+        if (nxt == l_meta.l)
+            break;
+
+        element_t *item = list_entry(forward ? cur : nxt, element_t, list);
+        element_t *next_item = list_entry(forward ? nxt : cur, element_t, list);
+        if (strcasecmp(item->value, next_item->value) > 0)
+            return false;
+        cur = nxt;
+    }
+    return true;
+}
+
+/* Check that the current queue, of cnt elements, is in ascending order */
+static bool queue_sorted(int cnt)
+{
+    if (!l_meta.size)
+        return true;
+
+    bool full = verify_whole_queue();
+    /* Ensure each element in ascending order */
+    /* FIXME: add an option to specify sorting order */
+    bool ok = pairs_sorted(q_first(l_meta.l), true, full ? cnt : big_list_size);
+    if (ok && !full && cnt > big_list_size)
+        ok = pairs_sorted(q_last(l_meta.l), false, big_list_size);
+    if (!ok)
+        report(1, "ERROR: Not sorted in ascending order");
+    return ok;
+}
+
 bool do_sort(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_scaling(argc, argv, is_sort_nlogn, "O(n log n)");
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -712,35 +1227,78 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    set_noallocate_mode(true);
+    if (exception_setup(true)) {
+        if (sort_threads > 1)
+            q_sort_parallel(l_meta.l, sort_threads);
+        else
+            q_sort(l_meta.l);
+    }
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = queue_sorted(cnt);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_merge(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (list_empty(&queues)) {
+        report(3, "Warning: Calling merge without any queue");
+        return true;
+    }
+    queue_entry_t *first = list_first_entry(&queues, queue_entry_t, ctx.chain);
+    if (!first->ctx.q)
+        report(3, "Warning: Calling merge into null queue");
+    error_check();
+
+    /* Everything ends up in the first queue, unless it is NULL */
+    size_t cnt = chain_cnt();
+    int size = 0;
+    queue_entry_t *e;
+    list_for_each_entry (e, &queues, ctx.chain)
+        size += e->meta.size;
+    if (first->ctx.q) {
+        list_for_each_entry (e, &queues, ctx.chain) {
+            e->meta.size = 0;
+            e->cnt = 0;
+        }
+        first->meta.size = size;
+        first->cnt = cnt;
+    }
+    load_current(first);
+
+    int len = 0;
     set_noallocate_mode(true);
     if (exception_setup(true))
-        q_sort(l_meta.l);
+        len = q_merge(&queues);
     exception_cancel();
     set_noallocate_mode(false);
 
     bool ok = true;
-    if (l_meta.size) {
-        for (struct list_head *cur_l = l_meta.l->next;
-             cur_l != l_meta.l && --cnt; cur_l = cur_l->next) {
-            /* Ensure each element in ascending order */
-            /* FIXME: add an option to specify sorting order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcasecmp(item->value, next_item->value) > 0) {
-                report(1, "ERROR: Not sorted in ascending order");
-                ok = false;
-                break;
-            }
-        }
+    if (len != l_meta.size) {
+        report(1, "ERROR: Merged queue has %d elements, but %d were expected",
+               len, l_meta.size);
+        ok = false;
     }
+    ok = ok && queue_sorted(len);
 
+    report(3, "Queue %d is current", current->ctx.id);
     show_queue(3);
     return ok && !error_check();
 }
 
 static bool do_dm(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_scaling(argc, argv, is_delete_mid_linear, "O(n)");
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -761,6 +1319,9 @@ static bool do_dm(int argc, char *argv[])
 
 static bool do_swap(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate_scaling(argc, argv, is_swap_linear, "O(n)");
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -781,24 +1342,37 @@ static bool do_swap(int argc, char *argv[])
     return !error_check();
 }
 
-static bool is_circular()
+/*
+ * Follow up to limit links from the head of the queue, forward or backward,
+ * checking that each node links back to the one it was reached from.
+ * A single pass thus covers both directions. Store the number of nodes
+ * visited in *cntp.
+ */
+static bool links_ok(bool forward, size_t limit, size_t *cntp)
 {
-    struct list_head *cur = l_meta.l->next;
-    while (cur != l_meta.l) {
-        if (!cur)
-            return false;
-        cur = cur->next;
-    }
-
-    cur = l_meta.l->prev;
-    while (cur != l_meta.l) {
-        if (!cur)
+    struct list_head *cur = l_meta.l;
+    size_t cnt = 0;
+    while (cnt < limit) {
+        struct list_head *nxt = forward ? cur->next : cur->prev;
+        if (!nxt || (forward ? nxt->prev : nxt->next) != cur)
             return false;
-        cur = cur->prev;
+        if (nxt == l_meta.l)
+            break;
+        cur = nxt;
+        cnt++;
     }
+    *cntp = cnt;
     return true;
 }
 
+static bool is_circular(bool full, size_t *cntp)
+{
+    if (full)
+        return links_ok(true, SIZE_MAX, cntp);
+    return links_ok(true, big_list_size, cntp) &&
+           links_ok(false, big_list_size, cntp);
+}
+
 static bool show_queue(int vlevel)
 {
     bool ok = true;
@@ -811,7 +1385,9 @@ static bool show_queue(int vlevel)
         return true;
     }
 
-    if (!is_circular()) {
+    bool full = verify_whole_queue();
+    size_t len;
+    if (!is_circular(full, &len)) {
         report(vlevel, "ERROR:  Queue is not doubly circular");
         return false;
     }
@@ -819,15 +1395,14 @@ static bool show_queue(int vlevel)
     report_noreturn(vlevel, "l = [");
 
     struct list_head *ori = l_meta.l;
-    struct list_head *cur = l_meta.l->next;
+    struct list_head *cur = q_first(l_meta.l);
 
     if (exception_setup(true)) {
-        while (ok && ori != cur && cnt < lcnt) {
+        while (ok && ori != cur && cnt < big_list_size) {
             element_t *e = list_entry(cur, element_t, list);
-            if (cnt < big_list_size)
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
+            report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
             cnt++;
-            cur = cur->next;
+            cur = q_next(l_meta.l, cur);
             ok = ok && !error_check();
         }
     }
@@ -838,13 +1413,8 @@ static bool show_queue(int vlevel)
         return false;
     }
 
-    if (cur == ori) {
-        if (cnt <= big_list_size)
-            report(vlevel, "]");
-        else
-            report(vlevel, " ... ]");
-    } else {
-        report(vlevel, " ... ]");
+    report(vlevel, cur == ori ? "]" : " ... ]");
+    if (full && len > lcnt) {
         report(vlevel, "ERROR:  Queue has more than %d elements", lcnt);
         ok = false;
     }
@@ -852,6 +1422,409 @@ static bool show_queue(int vlevel)
     return ok;
 }
 
+/*
+ * Stress test of the concurrent queue of cqueue.h: producer threads insert n
+ * strings in total, while consumer threads remove them as they come.
+ * Meanwhile, this thread sorts the queue as often as asked, each sort
+ * stopping all other operations.
+ */
+#define MT_MAX_THREADS 64
+
+struct mt_worker {
+    pthread_t tid;
+    cqueue_t *q;
+    bool producer, at_head;
+    const char *str; /* String to insert, and to expect on removal */
+    char *rand_strs; /* Producer's random strings, MAX_RANDSTR_LEN apart */
+    int ops;         /* Insertions to do */
+    long *left;      /* Removals still to come, shared by all threads */
+    long done, failed;
+    double seconds;
+    harness_stats_t *stats;
+};
+
+static void mt_produce(struct mt_worker *w)
+{
+    for (int i = 0; i < w->ops; i++) {
+        const char *s =
+            w->rand_strs ? w->rand_strs + (size_t) i * MAX_RANDSTR_LEN : w->str;
+        if (w->at_head ? cq_insert_head(w->q, s) : cq_insert_tail(w->q, s))
+            w->done++;
+        else {
+            /* That one will never come, so do not let consumers wait */
+            __atomic_fetch_sub(w->left, 1, __ATOMIC_RELAXED);
+            w->failed++;
+        }
+    }
+}
+
+static void mt_consume(struct mt_worker *w)
+{
+    char buf[256];
+
+    while (__atomic_load_n(w->left, __ATOMIC_RELAXED) > 0) {
+        if (!cq_remove_head(w->q, buf, sizeof(buf))) {
+            sched_yield();
+            continue;
+        }
+        __atomic_fetch_sub(w->left, 1, __ATOMIC_RELAXED);
+        w->done++;
+        if (w->str && strncmp(buf, w->str, sizeof(buf) - 1))
+            w->failed++;
+    }
+}
+
+static void *mt_thread(void *arg)
+{
+    struct mt_worker *w = arg;
+    double t;
+
+    w->stats = harness_thread_begin();
+    init_time(&t);
+    if (w->producer)
+        mt_produce(w);
+    else
+        mt_consume(w);
+    w->seconds = delta_time(&t);
+    return NULL;
+}
+
+static void mt_report(struct mt_worker *w, int i)
+{
+    report(1, "%s %2d: %8ld %s in %.3f s, %.2f M ops/sec",
+           w->producer ? "producer" : "consumer", i, w->done,
+           w->producer ? "insertions" : "removals ", w->seconds,
+           w->seconds > 0 ? w->done / w->seconds / 1e6 : 0.0);
+}
+
+static bool do_mt(int argc, char *argv[])
+{
+    int n = 1, nprod = 1, ncons = 1, nsorts = 0;
+    bool at_head = argc > 1 && !strcmp(argv[1], "ih");
+
+    if (argc < 3 || (!at_head && strcmp(argv[1], "it"))) {
+        report(1, "%s needs ih or it, a string and optional settings",
+               argv[0]);
+        return false;
+    }
+
+    int i = 3;
+    if (i < argc && get_int(argv[i], &n))
+        i++;
+    for (; i < argc; i += 2) {
+        int *val = NULL;
+        if (!strcmp(argv[i], "producers"))
+            val = &nprod;
+        else if (!strcmp(argv[i], "consumers"))
+            val = &ncons;
+        else if (!strcmp(argv[i], "sorts"))
+            val = &nsorts;
+        if (!val || i + 1 == argc || !get_int(argv[i + 1], val)) {
+            report(1, "Invalid setting '%s'", argv[i]);
+            return false;
+        }
+    }
+    if (n < 1 || nprod < 1 || nprod > MT_MAX_THREADS || ncons < 0 ||
+        ncons > MT_MAX_THREADS || nsorts < 0) {
+        report(1, "Need n >= 1, 1 to %d producers and 0 to %d consumers",
+               MT_MAX_THREADS, MT_MAX_THREADS);
+        return false;
+    }
+
+    bool need_rand = !strcmp(argv[2], "RAND");
+    size_t blocks = allocation_check();
+    cqueue_t *q = cq_new();
+    if (!q) {
+        report(1, "ERROR: Could not allocate concurrent queue");
+        return false;
+    }
+
+    struct mt_worker workers[2 * MT_MAX_THREADS];
+    int nworkers = nprod + ncons;
+    long left = ncons ? n : 0;
+    bool ok = true;
+    for (i = 0; i < nworkers; i++) {
+        struct mt_worker *w = &workers[i];
+        memset(w, 0, sizeof(*w));
+        w->q = q;
+        w->producer = i < nprod;
+        w->at_head = at_head;
+        w->str = need_rand ? NULL : argv[2];
+        w->left = &left;
+        if (!w->producer)
+            continue;
+
+        w->ops = n / nprod + (i < n % nprod);
+        if (need_rand) {
+            w->rand_strs = malloc((size_t) w->ops * MAX_RANDSTR_LEN);
+            if (!w->rand_strs) {
+                report(1, "ERROR: Could not allocate random strings");
+                nworkers = i;
+                ok = false;
+                break;
+            }
+            for (int j = 0; j < w->ops; j++)
+                fill_rand_string(w->rand_strs + (size_t) j * MAX_RANDSTR_LEN,
+                                 MAX_RANDSTR_LEN);
+        }
+    }
+
+    /* Injected failures would need the generator, which is not shared */
+    int saved_fail_probability = fail_probability;
+    fail_probability = 0;
+    set_threaded_mode(true);
+
+    /* As with sort, signals meant for qtest go to this thread */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    double t;
+    init_time(&t);
+    for (i = 0; ok && i < nworkers; i++) {
+        if (pthread_create(&workers[i].tid, NULL, mt_thread, &workers[i])) {
+            report(1, "ERROR: Could not start thread %d", i);
+            nworkers = i;
+            ok = false;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    /* Nothing more is coming if a producer is missing */
+    if (!ok)
+        __atomic_store_n(&left, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < nsorts; i++)
+        cq_sort(q);
+
+    for (i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].tid, NULL);
+        harness_thread_end(workers[i].stats);
+    }
+    double elapsed = delta_time(&t);
+    set_threaded_mode(false);
+    fail_probability = saved_fail_probability;
+
+    long inserted = 0, removed = 0, failed = 0;
+    for (i = 0; i < nworkers; i++) {
+        struct mt_worker *w = &workers[i];
+        mt_report(w, w->producer ? i : i - nprod);
+        if (w->producer)
+            inserted += w->done;
+        else
+            removed += w->done;
+        failed += w->failed;
+        free(w->rand_strs);
+    }
+    report(1, "total: %ld insertions, %ld removals in %.3f s, %.2f M ops/sec",
+           inserted, removed, elapsed,
+           elapsed > 0 ? (inserted + removed) / elapsed / 1e6 : 0.0);
+
+    if (failed) {
+        report(1, "ERROR: %ld operations failed or removed a wrong string",
+               failed);
+        ok = false;
+    }
+    if (cq_size(q) != inserted - removed) {
+        report(1, "ERROR: Queue holds %d elements, but %ld are left",
+               cq_size(q), inserted - removed);
+        ok = false;
+    }
+
+    cq_free(q);
+    if (allocation_check() != blocks) {
+        report(1, "ERROR: %ld blocks lost or freed twice by concurrent queue",
+               (long) (allocation_check() - blocks));
+        ok = false;
+    }
+
+    return ok && !error_check();
+}
+
+/*
+ * Queue image written by save and read back by load
+ *
+ * The header is followed by one entry per element, in queue order: the
+ * length of the string as a 32-bit integer, then the string and its null
+ * terminator. Since integers are in host byte order, an image is meant to be
+ * loaded on the kind of machine which saved it. The checksum is the FNV-1a
+ * hash of all entries.
+ */
+#define IMAGE_MAGIC "lab0img"
+#define IMAGE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;    /* Number of entries */
+    uint64_t bytes;    /* Size of all entries together */
+    uint64_t checksum;
+} image_header_t;
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t fnv1a(uint64_t h, const void *p, size_t n)
+{
+    const unsigned char *b = p;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ b[i]) * FNV_PRIME;
+    return h;
+}
+
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!l_meta.l) {
+        report(1, "ERROR: Calling save on null queue");
+        return false;
+    }
+
+    FILE *f = fopen(argv[1], "wb");
+    if (!f) {
+        report(1, "ERROR: Could not open '%s': %s", argv[1], strerror(errno));
+        return false;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    /* Written once more at the end, when the totals are known */
+    image_header_t h = {.magic = IMAGE_MAGIC, .version = IMAGE_VERSION};
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+
+    uint64_t sum = FNV_OFFSET;
+    element_t *e;
+    q_for_each_entry (e, l_meta.l) {
+        uint32_t len = strlen(e->value);
+        ok = ok && fwrite(&len, sizeof(len), 1, f) == 1 &&
+             fwrite(e->value, len + 1, 1, f) == 1;
+        sum = fnv1a(sum, &len, sizeof(len));
+        sum = fnv1a(sum, e->value, len + 1);
+        h.count++;
+        h.bytes += sizeof(len) + len + 1;
+    }
+    h.checksum = sum;
+    ok = ok && !fseek(f, 0, SEEK_SET) && fwrite(&h, sizeof(h), 1, f) == 1;
+    ok = !fclose(f) && ok;
+
+    if (!ok) {
+        report(1, "ERROR: Could not write '%s'", argv[1]);
+        return false;
+    }
+    report(2, "Saved %lu elements to %s", (unsigned long) h.count, argv[1]);
+    return true;
+}
+
+/* Check that an image of size bytes at map is complete and undamaged */
+static bool image_valid(const char *name, const char *map, size_t size)
+{
+    const image_header_t *h = (const image_header_t *) map;
+    if (size < sizeof(*h) || memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) ||
+        h->version != IMAGE_VERSION) {
+        report(1, "ERROR: '%s' is not a queue image", name);
+        return false;
+    }
+    if (h->bytes != size - sizeof(*h)) {
+        report(1, "ERROR: Queue image '%s' is truncated", name);
+        return false;
+    }
+    if (h->count > INT_MAX) {
+        report(1, "ERROR: Queue image '%s' holds too many elements", name);
+        return false;
+    }
+
+    const char *p = map + sizeof(*h), *end = map + size;
+    uint64_t n = 0;
+    while (end - p >= (ptrdiff_t) sizeof(uint32_t)) {
+        uint32_t len;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if ((size_t) (end - p) <= len || p[len])
+            break;
+        p += len + 1;
+        n++;
+    }
+    if (p != end || n != h->count ||
+        fnv1a(FNV_OFFSET, map + sizeof(*h), h->bytes) != h->checksum) {
+        report(1, "ERROR: Queue image '%s' is corrupted", name);
+        return false;
+    }
+    return true;
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        report(1, "ERROR: Could not open '%s': %s", argv[1], strerror(errno));
+        return false;
+    }
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        report(1, "ERROR: Could not map '%s'", argv[1]);
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    bool ok = image_valid(argv[1], map, st.st_size);
+    if (ok && !l_meta.l)
+        report(3, "Warning: Calling load on null queue");
+    error_check();
+
+    /*
+     * The strings are inserted straight from the mapping, a batch at once.
+     * Like ih and it, malloc failure injection takes them one by one.
+     */
+    if (ok && exception_setup(true)) {
+        const image_header_t *h = (const image_header_t *) map;
+        const char *p = map + sizeof(*h);
+        char *strs[BULK_BATCH];
+        int batch = fail_probability ? 1 : BULK_BATCH;
+        for (uint64_t left = h->count; ok && left;) {
+            int n = left < (uint64_t) batch ? (int) left : batch;
+            for (int i = 0; i < n; i++) {
+                uint32_t len;
+                memcpy(&len, p, sizeof(len));
+                strs[i] = (char *) p + sizeof(len);
+                p += sizeof(len) + len + 1;
+            }
+
+            if (q_insert_tail_bulk(l_meta.l, strs, n)) {
+                lcnt += n;
+                l_meta.size += n;
+            } else {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %d elements failed", n);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %d elements failed (%d "
+                           "failures total)",
+                           n, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+            left -= n;
+        }
+    }
+    exception_cancel();
+    munmap(map, st.st_size);
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
 static bool do_show(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -861,10 +1834,36 @@ static bool do_show(int argc, char *argv[])
     return show_queue(0);
 }
 
+static bool do_meminfo(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    show_meminfo(1, chain_cnt());
+    report_mem_usage(1);
+    return true;
+}
+
+static void seed_changed(int oldval)
+{
+    prng_seed((uint64_t) (unsigned int) seed);
+}
+
 static void console_init()
 {
-    ADD_COMMAND(new, "                | Create new queue");
-    ADD_COMMAND(free, "                | Delete queue");
+    ADD_COMMAND(new,
+                "                | Create new queue behind the current one, "
+                "and make it current");
+    ADD_COMMAND(free,
+                "                | Delete queue, making the one in front of "
+                "it current");
+    ADD_COMMAND(prev, "                | Make the previous queue current");
+    ADD_COMMAND(next, "                | Make the next queue current");
+    ADD_COMMAND(merge,
+                "                | Merge all sorted queues into the first "
+                "one");
     ADD_COMMAND(
         ih,
         " str [n]        | Insert string str at head of queue n times. "
@@ -875,31 +1874,75 @@ static void console_init()
         "Generate random string(s) if str equals RAND. (default: n == 1)");
     ADD_COMMAND(
         rh,
-        " [str]          | Remove from head of queue.  Optionally compare "
-        "to expected value str");
+        " [str [n]]      | Remove from head of queue.  Optionally compare "
+        "to expected value str.  With n, remove n elements at once, each "
+        "equal to str, or to anything if str is -");
     ADD_COMMAND(
         rt,
-        " [str]          | Remove from tail of queue.  Optionally compare "
-        "to expected value str");
-    ADD_COMMAND(
-        rhq,
-        "                | Remove from head of queue without reporting value.");
+        " [str [n]]      | Remove from tail of queue.  Optionally compare "
+        "to expected value str.  With n, remove n elements at once, each "
+        "equal to str, or to anything if str is -");
+    ADD_COMMAND(rhq,
+                " [n]            | Remove from head of queue without reporting "
+                "value. (default: n == 1)");
     ADD_COMMAND(reverse, "                | Reverse queue");
     ADD_COMMAND(sort, "                | Sort queue in ascending order");
     ADD_COMMAND(
         size, " [n]            | Compute queue size n times (default: n == 1)");
     ADD_COMMAND(show, "                | Show queue contents");
+    ADD_COMMAND(meminfo,
+                "                | Show memory usage of queue and console");
     ADD_COMMAND(dm, "                | Delete middle node in queue");
     ADD_COMMAND(
         dedup, "                | Delete all nodes that have duplicate string");
     ADD_COMMAND(swap,
                 "                | Swap every two adjacent nodes in queue");
+    ADD_COMMAND(save,
+                " file           | Write queue contents to file as an image");
+    ADD_COMMAND(load,
+                " file           | Insert the strings of the image in file "
+                "at tail of queue");
+    ADD_COMMAND(mt,
+                " ih|it str [n] [producers P] [consumers C] [sorts S] | "
+                "Insert str, or random strings if str equals RAND, n times "
+                "into a concurrent queue from P threads, while C threads "
+                "remove them and the queue is sorted S times. "
+                "(default: n == P == C == 1, S == 0)");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("inline", &q_inline_value,
+              "Store strings inline in queue elements (0 = separate buffer)",
+              NULL);
+    add_param("seed", &seed,
+              "Seed of the random generator, for reproducible runs",
+              seed_changed);
+    add_param("pool", &q_use_pool,
+              "Give new queues a slab allocator for elements and strings",
+              NULL);
+    add_param("intern", &q_intern_value,
+              "Share one reference-counted copy of equal strings", NULL);
+    add_param("threads", &sort_threads,
+              "Threads used by sort (1 = single-threaded q_sort)", NULL);
+    add_param("dedup", &dedup_unsorted,
+              "Make dedup keep the order of an unsorted queue "
+              "(q_delete_dup_unsorted)",
+              NULL);
+    add_param("pin", &dudect_cpu,
+              "CPU to pin simulation measurements to (-1 = no pinning)", NULL);
+    add_param("workers", &dudect_workers,
+              "Processes to run simulation measurements in", NULL);
+    add_param("verify", &verify_policy,
+              "Queue checks after each command (0 = full, 1 = sampled, "
+              "2 = ends only)",
+              NULL);
+    add_param("sample", &verify_period,
+              "In sampled verification, check the whole queue every this many "
+              "commands",
+              NULL);
 }
 
 /* Signal handlers */
@@ -908,12 +1951,14 @@ static void sigsegvhandler(int sig)
     report(1,
            "Segmentation fault occurred.  You dereferenced a NULL or invalid "
            "pointer");
+    report_flush();
     /* Raising a SIGABRT signal to produce a core dump for debugging. */
     abort();
 }
 
 static void sigalrmhandler(int sig)
 {
+    report_flush();
     trigger_exception(
         "Time limit exceeded.  Either you are in an infinite loop, or your "
         "code is too inefficient");
@@ -929,14 +1974,22 @@ static void queue_init()
 
 static bool queue_quit(int argc, char *argv[])
 {
+    /* End-of-run summary, taken while the queue is still alive */
+    report(3, "Memory usage:");
+    show_meminfo(3, chain_cnt());
+    report_mem_usage(3);
+
     report(3, "Freeing queue");
-    if (lcnt > big_list_size)
-        set_cautious_mode(false);
 
-    if (exception_setup(true))
-        q_free(l_meta.l);
-    exception_cancel();
-    set_cautious_mode(true);
+    while (!list_empty(&queues)) {
+        queue_entry_t *e = list_first_entry(&queues, queue_entry_t, ctx.chain);
+        list_del(&e->ctx.chain);
+        if (exception_setup(true))
+            q_free(e->ctx.q);
+        exception_cancel();
+        free(e);
+    }
+    load_current(NULL);
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1028,7 +2081,7 @@ int main(int argc, char *argv[])
         }
         case 'l':
             strncpy(lbuf, optarg, BUFSIZE);
-            buf[BUFSIZE - 1] = '\0';
+            lbuf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
         default:
@@ -1038,7 +2091,6 @@ int main(int argc, char *argv[])
         }
     }
 
-    srand((unsigned int) (time(NULL)));
     queue_init();
     init_cmd();
     console_init();
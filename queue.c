@@ -1,10 +1,15 @@
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "chunk.h"
 #include "harness.h"
+#include "intern.h"
 #include "list.h"
+#include "pool.h"
 #include "queue.h"
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
@@ -13,18 +18,57 @@
  *   cppcheck-suppress nullPointer
  */
 
+int q_inline_value = 1;
+int q_use_pool = 0;
+int q_intern_value = 0;
+
+/* Bits of element_t.flags */
+#define ELEMENT_POOLED 1   /* Element and string came from the queue's pool */
+#define ELEMENT_CHUNKED 2  /* Element sits in a slot of the queue's chunks */
+#define ELEMENT_INTERNED 4 /* String belongs to the intern table */
+
+/* Get the queue descriptor which embeds the given head */
+static inline queue_t *to_queue(struct list_head *head)
+{
+    return container_of(head, queue_t, head);
+}
+
 /*
  * Create empty queue.
  * Return NULL if could not allocate space.
  */
 struct list_head *q_new()
 {
-    struct list_head *q = (struct list_head *) malloc(sizeof(struct list_head));
+    queue_t *q = (queue_t *) malloc(sizeof(queue_t));
     if (!q)
         return NULL;
-    INIT_LIST_HEAD(q);
+    INIT_LIST_HEAD(&q->head);
+    q->size = 0;
+    q->mid = NULL;
+    q->reversed = false;
+    q->foreign = false;
+    q->pool = NULL;
+    q->chunks = NULL;
+
+#ifdef QUEUE_CHUNKED
+    q->chunks = (chunk_deque_t *) malloc(sizeof(chunk_deque_t));
+    if (!q->chunks) {
+        free(q);
+        return NULL;
+    }
+    chunk_init(q->chunks);
+#else
+    if (q_use_pool) {
+        q->pool = (pool_t *) malloc(sizeof(pool_t));
+        if (!q->pool) {
+            free(q);
+            return NULL;
+        }
+        pool_init(q->pool);
+    }
+#endif
 
-    return q;
+    return &q->head;
 }
 
 /* Free all storage used by queue */
@@ -33,8 +77,22 @@ void q_free(struct list_head *l)
     if (!l)
         return;
 
-    if (list_empty(l)) {
-        free(l);
+    queue_t *q = to_queue(l);
+    if (q->pool) {
+        // Elements from elsewhere and interned strings still need to be
+        // given back, everything else goes along with the slabs.
+        if (q->foreign || intern_count()) {
+            element_t *e, *safe;
+            list_for_each_entry_safe (e, safe, l, list) {
+                if (!(e->flags & ELEMENT_POOLED))
+                    q_release_element(e);
+                else if (e->flags & ELEMENT_INTERNED)
+                    intern_put(e->value);
+            }
+        }
+        pool_destroy(q->pool);
+        free(q->pool);
+        free(q);
         return;
     }
 
@@ -44,43 +102,272 @@ void q_free(struct list_head *l)
         element_t *e = container_of(cur, element_t, list);
         q_release_element(e);
     }
-    free(l);
+    if (q->chunks) {
+        chunk_destroy(q->chunks);
+        free(q->chunks);
+    }
+    free(to_queue(l));
+}
+
+/* Allocate from the queue's pool if it has one, else from malloc */
+static inline void *q_alloc(queue_t *q, size_t size)
+{
+    return q->pool ? pool_alloc(q->pool, size) : malloc(size);
+}
+
+static inline void q_dealloc(queue_t *q, void *p)
+{
+    if (q->pool)
+        pool_free(p);
+    else
+        free(p);
 }
 
 /*
- * Attempt to insert element at head of queue.
- * Return true if successful.
- * Return false if q is NULL or could not allocate space.
- * Argument s points to the string to be stored.
- * The function must explicitly allocate space and copy the string into it.
+ * Direction of the list
+ *
+ * While q->reversed is set, the queue starts at the tail of the list and
+ * runs backwards, so that q_reverse() only flips the flag. Operations at an
+ * end of the queue work on the opposite end of the list; those needing the
+ * elements in list order put them back in queue order first.
  */
-bool q_insert_head(struct list_head *head, char *s)
+
+/* Whether the head, or the tail, of the queue q is at the front of its list */
+static inline bool at_list_front(const queue_t *q, bool at_head)
 {
-    if (!head)
-        return false;
+    return at_head != q->reversed;
+}
 
-    element_t *node = (element_t *) malloc(sizeof(element_t));
+/* Reverse the order of the nodes of a list */
+static void reverse_list(struct list_head *head)
+{
+    struct list_head *node = NULL;
+    struct list_head *safe = NULL;
+    list_for_each_safe (node, safe, head) {
+        list_move(node, head);
+    }
+}
+
+void q_materialize(struct list_head *head)
+{
+    if (!head || !to_queue(head)->reversed)
+        return;
+
+    // The queue order stays the same, and so does its middle node.
+    reverse_list(head);
+    to_queue(head)->reversed = false;
+}
 
+/*
+ * The middle cursor q->mid is the node at index size / 2 in queue order, as
+ * found by q_delete_mid(). An insertion or removal at an end moves it by at
+ * most one node, as below. Operations which move nodes around, or add or
+ * drop many at once, forget it instead, and q_delete_mid() looks for it
+ * again.
+ */
+
+/* Keep q->mid for k nodes just linked in at an end, before q->size grows */
+static inline void mid_inserted(queue_t *q, bool at_head, int k)
+{
+    if (!q->mid)
+        return;
+    for (int size = q->size; size < q->size + k; size++) {
+        if (at_head && !(size & 1))
+            q->mid = q_prev(&q->head, q->mid);
+        else if (!at_head && (size & 1))
+            q->mid = q_next(&q->head, q->mid);
+    }
+}
+
+/* Keep q->mid for the node at an end about to be unlinked */
+static inline void mid_removing(queue_t *q, bool at_head)
+{
+    if (!q->mid)
+        return;
+    if (q->size == 1)
+        q->mid = NULL;
+    else if (at_head && (q->size & 1))
+        q->mid = q_next(&q->head, q->mid);
+    else if (!at_head && !(q->size & 1))
+        q->mid = q_prev(&q->head, q->mid);
+}
+
+#define KEY_BYTES sizeof(uint64_t)
+
+#define LEN_MAX ((1u << 24) - 1)
+
+/*
+ * Cache the key prefix and the length of the len bytes long string of e.
+ * Its hash is left to be computed when needed.
+ */
+static inline void set_key(element_t *e, size_t len)
+{
+    uint64_t key = 0;
+    memcpy(&key, e->value, len < KEY_BYTES ? len : KEY_BYTES);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    key = __builtin_bswap64(key);
+#endif
+    e->key = key;
+    e->len = len < LEN_MAX ? (uint32_t) len : LEN_MAX;
+    e->hash = 0;
+}
+
+/*
+ * Place an element of len bytes of string in the chunks of q, next to the
+ * elements at its head or at its tail. The string goes into the slot if it
+ * fits and q_inline_value allows, else into a buffer of its own.
+ */
+static element_t *chunk_element(queue_t *q, size_t len, bool at_head)
+{
+    element_t *node = at_head ? chunk_alloc_head(q->chunks)
+                              : chunk_alloc_tail(q->chunks);
     if (!node)
-        return false;
+        return NULL;
 
-    // Need to add 1 to cover the '\0'
-    size_t length = strlen(s) + 1;
-    node->value = (char *) malloc(sizeof(length));
+    node->flags = ELEMENT_CHUNKED;
+    if (q_inline_value && sizeof(element_t) + len <= CHUNK_OBJ_SIZE) {
+        node->value = node->data;
+        return node;
+    }
 
+    node->value = (char *) malloc(len);
+    if (!node->value) {
+        chunk_free(node);
+        return NULL;
+    }
+    return node;
+}
+
+/*
+ * Allocate an element of q referring to the interned copy of the len bytes
+ * long string s, to be inserted at the head or at the tail.
+ */
+static element_t *interned_element(queue_t *q,
+                                   const char *s,
+                                   size_t len,
+                                   bool at_head)
+{
+    char *value = intern_get(s, len);
+    if (!value)
+        return NULL;
+
+    element_t *node;
+    if (q->chunks)
+        node = at_head ? chunk_alloc_head(q->chunks)
+                       : chunk_alloc_tail(q->chunks);
+    else
+        node = (element_t *) q_alloc(q, sizeof(element_t));
+    if (!node) {
+        intern_put(value);
+        return NULL;
+    }
+
+    node->flags = ELEMENT_INTERNED;
+    if (q->chunks)
+        node->flags |= ELEMENT_CHUNKED;
+    else if (q->pool)
+        node->flags |= ELEMENT_POOLED;
+    node->value = value;
+    set_key(node, len);
+    return node;
+}
+
+/*
+ * Allocate an element of q holding a copy of s, laid out as q_inline_value
+ * and q_intern_value ask, to be inserted at the head or at the tail.
+ * Return NULL if could not allocate space.
+ */
+static element_t *new_element(queue_t *q, const char *s, bool at_head)
+{
+    if (q_intern_value)
+        return interned_element(q, s, strlen(s), at_head);
 
-    if (node->value) {
-        strncpy(node->value, s, length);
+    // Need to add 1 to cover the '\0'
+    size_t len = strlen(s) + 1;
+    element_t *node;
+
+    if (q->chunks) {
+        node = chunk_element(q, len, at_head);
+        if (!node)
+            return NULL;
+    } else if (q_inline_value) {
+        node = (element_t *) q_alloc(q, sizeof(element_t) + len);
+        if (!node)
+            return NULL;
+        node->value = node->data;
     } else {
-        free(node);
-        return false;
+        node = (element_t *) q_alloc(q, sizeof(element_t));
+        if (!node)
+            return NULL;
+        node->value = (char *) q_alloc(q, len);
+        if (!node->value) {
+            q_dealloc(q, node);
+            return NULL;
+        }
     }
+    if (!q->chunks)
+        node->flags = q->pool ? ELEMENT_POOLED : 0;
 
-    list_add(&node->list, head);
+    memcpy(node->value, s, len);
+    set_key(node, len - 1);
+    return node;
+}
 
+/* Order two elements as strcmp orders their strings */
+static inline int cmp_value(const element_t *a, const element_t *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    /* Equal keys with a string ending inside them mean equal strings */
+    if (a->len < KEY_BYTES || a->value == b->value)
+        return 0;
+    return strcmp(a->value + KEY_BYTES, b->value + KEY_BYTES);
+}
+
+static inline bool same_value(const element_t *a, const element_t *b)
+{
+    if (a->value == b->value)
+        return true;
+    /* Equal interned strings share their address */
+    if (a->flags & b->flags & ELEMENT_INTERNED)
+        return false;
+    return a->key == b->key && a->len == b->len &&
+           (a->len < KEY_BYTES ||
+            strcmp(a->value + KEY_BYTES, b->value + KEY_BYTES) == 0);
+}
+
+/* Insert a copy of s at the head or at the tail of the queue q */
+static bool insert(queue_t *q, const char *s, bool at_head)
+{
+    bool list_front = at_list_front(q, at_head);
+    element_t *node = new_element(q, s, list_front);
+    if (!node)
+        return false;
+
+    if (list_front)
+        list_add(&node->list, &q->head);
+    else
+        list_add_tail(&node->list, &q->head);
+    mid_inserted(q, at_head, 1);
+    q->size++;
     return true;
 }
 
+/*
+ * Attempt to insert element at head of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    if (!head)
+        return false;
+
+    return insert(to_queue(head), s, true);
+}
+
 /*
  * Attempt to insert element at tail of queue.
  * Return true if successful.
@@ -93,22 +380,98 @@ bool q_insert_tail(struct list_head *head, char *s)
     if (!head)
         return false;
 
-    element_t *node = (element_t *) malloc(sizeof(element_t));
+    return insert(to_queue(head), s, false);
+}
 
-    if (!node)
+/*
+ * Allocate elements holding copies of s[0..n-1] into the empty list chain.
+ * Each element goes in front of the previous one if reverse is set, after it
+ * otherwise. Return false, leaving chain empty, if could not allocate space.
+ */
+static bool new_chain(queue_t *q,
+                      struct list_head *chain,
+                      char **s,
+                      int n,
+                      bool reverse)
+{
+    for (int i = 0; i < n; i++) {
+        element_t *node = new_element(q, s[i], reverse);
+        if (!node) {
+            struct list_head *cur, *safe;
+            list_for_each_safe (cur, safe, chain)
+                q_release_element(list_entry(cur, element_t, list));
+            INIT_LIST_HEAD(chain);
+            return false;
+        }
+        if (reverse)
+            list_add(&node->list, chain);
+        else
+            list_add_tail(&node->list, chain);
+    }
+
+    return true;
+}
+
+/* Insert copies of s[0..n-1] at the head or the tail of q, one after another */
+static bool insert_bulk(queue_t *q, char **s, int n, bool at_head)
+{
+    bool list_front = at_list_front(q, at_head);
+    LIST_HEAD(chain);
+    if (!new_chain(q, &chain, s, n, list_front))
         return false;
 
-    size_t len = strlen(s) + 1;
-    node->value = (char *) malloc(sizeof(len));
-    if (node->value) {
-        strncpy(node->value, s, len);
-    } else {
-        free(node);
+    if (list_front)
+        list_splice(&chain, &q->head);
+    else
+        list_splice_tail(&chain, &q->head);
+    mid_inserted(q, at_head, n);
+    q->size += n;
+    return true;
+}
+
+/*
+ * Attempt to insert n elements at head of queue, as q_insert_head() would do
+ * for s[0], ..., s[n - 1] in turn, with a single splice.
+ * Return false, leaving the queue untouched, if could not allocate space.
+ */
+bool q_insert_head_bulk(struct list_head *head, char **s, int n)
+{
+    if (!head || n <= 0)
         return false;
+
+    return insert_bulk(to_queue(head), s, n, true);
+}
+
+/*
+ * Attempt to insert n elements at tail of queue, as q_insert_tail() would do
+ * for s[0], ..., s[n - 1] in turn, with a single splice.
+ * Return false, leaving the queue untouched, if could not allocate space.
+ */
+bool q_insert_tail_bulk(struct list_head *head, char **s, int n)
+{
+    if (!head || n <= 0)
+        return false;
+
+    return insert_bulk(to_queue(head), s, n, false);
+}
+
+/* Unlink the element at the head or at the tail of the non-empty queue q */
+static element_t *remove_end(queue_t *q, char *sp, size_t bufsize, bool at_head)
+{
+    struct list_head *node =
+        at_list_front(q, at_head) ? q->head.next : q->head.prev;
+    element_t *e = list_entry(node, element_t, list);
+    mid_removing(q, at_head);
+    list_del_init(node);
+    q->size--;
+
+    // Need to check sp is already been allocate, and element is not removed..
+    if (sp) {
+        strncpy(sp, e->value, bufsize - 1);
+        sp[bufsize - 1] = '\0';
     }
 
-    list_add_tail(&node->list, head);
-    return true;
+    return e;
 }
 
 /*
@@ -130,16 +493,7 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
     if (!head || list_empty(head))
         return NULL;
 
-    element_t *e = list_first_entry(head, element_t, list);
-    list_del_init(head->next);
-
-    // Need to check sp is already been allocate, and element is not removed..
-    if (sp) {
-        strncpy(sp, e->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
-
-    return e;
+    return remove_end(to_queue(head), sp, bufsize, true);
 }
 
 /*
@@ -151,25 +505,122 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
     if (!head || list_empty(head))
         return NULL;
 
-    element_t *e = list_last_entry(head, element_t, list);
-    list_del_init(head->prev);
+    return remove_end(to_queue(head), sp, bufsize, false);
+}
 
-    if (sp) {
-        strncpy(sp, e->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
+/*
+ * Return the k-th node (counting from 1) of a queue of size elements,
+ * where 0 < k <= size, walking from whichever end is closer.
+ */
+static struct list_head *nth_node(struct list_head *head, int size, int k)
+{
+    struct list_head *node;
+
+    if (k <= size / 2) {
+        node = head->next;
+        for (int i = 1; i < k; i++)
+            node = node->next;
+    } else {
+        node = head->prev;
+        for (int i = size; i > k; i--)
+            node = node->prev;
     }
 
+    return node;
+}
 
-    return e;
+/*
+ * Move the first, or the last, k nodes of the list of the non-empty queue q
+ * into to, in list order, where 0 < k < q->size.
+ */
+static void cut_list(queue_t *q, struct list_head *to, int k, bool list_front)
+{
+    struct list_head *head = &q->head;
+
+    if (list_front) {
+        list_cut_position(to, head, nth_node(head, q->size, k));
+    } else {
+        // Cut off the elements which stay, move the rest, then put them back.
+        LIST_HEAD(keep);
+        list_cut_position(&keep, head, nth_node(head, q->size, q->size - k));
+        list_splice_init(head, to);
+        list_splice(&keep, head);
+    }
+}
+
+/* Remove the first or the last k elements of q into to, in queue order */
+static int remove_n(queue_t *q, struct list_head *to, int k, bool at_head)
+{
+    if (k >= q->size) {
+        k = q->size;
+        list_splice_init(&q->head, to);
+    } else {
+        cut_list(q, to, k, at_list_front(q, at_head));
+    }
+    q->size -= k;
+    q->mid = NULL;
+
+    // The removed nodes came out in list order.
+    if (q->reversed)
+        reverse_list(to);
+    return k;
+}
+
+/*
+ * Attempt to remove the first k elements of queue into the list to.
+ * Return the number of elements removed.
+ */
+int q_remove_head_n(struct list_head *head, struct list_head *to, int k)
+{
+    INIT_LIST_HEAD(to);
+    if (!head || list_empty(head) || k <= 0)
+        return 0;
+
+    return remove_n(to_queue(head), to, k, true);
+}
+
+/*
+ * Attempt to remove the last k elements of queue into the list to.
+ * Return the number of elements removed.
+ */
+int q_remove_tail_n(struct list_head *head, struct list_head *to, int k)
+{
+    INIT_LIST_HEAD(to);
+    if (!head || list_empty(head) || k <= 0)
+        return 0;
+
+    return remove_n(to_queue(head), to, k, false);
 }
 
 /*
  * WARN: This is for external usage, don't modify it
  * Attempt to release element.
+ * Works for the inline, the separate-buffer and the interned layout alike.
  */
 void q_release_element(element_t *e)
 {
-    free(e->value);
+    bool own_value = e->value != e->data;
+    if (e->flags & ELEMENT_INTERNED) {
+        intern_put(e->value);
+        own_value = false;
+    }
+
+    if (e->flags & ELEMENT_CHUNKED) {
+        if (own_value)
+            free(e->value);
+        chunk_free(e);
+        return;
+    }
+
+    if (e->flags & ELEMENT_POOLED) {
+        if (own_value)
+            pool_free(e->value);
+        pool_free(e);
+        return;
+    }
+
+    if (own_value)
+        free(e->value);
     free(e);
 }
 
@@ -182,14 +633,7 @@ int q_size(struct list_head *head)
     if (!head)
         return 0;
 
-    size_t len = 0;
-
-    struct list_head *node = NULL;
-    list_for_each (node, head)
-        len++;
-
-
-    return len;
+    return to_queue(head)->size;
 }
 
 /*
@@ -207,18 +651,22 @@ bool q_delete_mid(struct list_head *head)
     if (!head || list_empty(head))
         return false;
 
-    struct list_head *front = head->next;
-    struct list_head *back = head->prev;
-
-    // Find middle node from both side of list, and front node would be the
-    // target which need to be removed.
-    while (front != back && back->prev != front) {
-        front = front->next;
-        back = back->prev;
+    queue_t *q = to_queue(head);
+    struct list_head *mid = q->mid;
+    if (!mid) {
+        int k = q->size / 2 + 1;
+        mid = nth_node(head, q->size, q->reversed ? q->size + 1 - k : k);
     }
 
-    list_del(front);
-    q_release_element(container_of(front, element_t, list));
+    // The node at index (size - 1) / 2 once mid is gone.
+    if (q->size == 1)
+        q->mid = NULL;
+    else
+        q->mid = q->size & 1 ? q_next(head, mid) : q_prev(head, mid);
+
+    list_del(mid);
+    q_release_element(container_of(mid, element_t, list));
+    q->size--;
 
     return true;
 }
@@ -241,15 +689,17 @@ bool q_delete_dup(struct list_head *head)
         struct list_head *ptr = NULL, *next = NULL;
         bool last_dup = false;
 
+        to_queue(head)->mid = NULL;
+
         list_for_each_safe (ptr, next, head) {
             element_t *cur_element = list_entry(ptr, element_t, list);
             bool match =
                 (next != head &&
-                 strcmp(cur_element->value,
-                        list_entry(next, element_t, list)->value) == 0);
+                 same_value(cur_element, list_entry(next, element_t, list)));
             if (match || last_dup) {
                 list_del(ptr);
                 q_release_element(cur_element);
+                to_queue(head)->size--;
             }
 
             last_dup = match;
@@ -259,6 +709,105 @@ bool q_delete_dup(struct list_head *head)
     return true;
 }
 
+/* Finalizer of MurmurHash3, so that every input bit affects every output bit */
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Hash of the string of e, computed once and cached in e->hash */
+static uint32_t element_hash(element_t *e)
+{
+    if (e->hash)
+        return e->hash;
+
+    /* The key already holds the first 8 bytes, mix in the rest word-wise */
+    uint64_t h = mix64(e->key ^ e->len);
+    if (e->len > KEY_BYTES) {
+        const char *p = e->value + KEY_BYTES;
+        size_t left = e->len < LEN_MAX ? e->len - KEY_BYTES : strlen(p);
+        for (; left >= sizeof(uint64_t);
+             p += sizeof(uint64_t), left -= sizeof(uint64_t)) {
+            uint64_t w;
+            memcpy(&w, p, sizeof(w));
+            h = mix64(h ^ w);
+        }
+        uint64_t w = 0;
+        memcpy(&w, p, left);
+        h = mix64(h ^ w);
+    }
+
+    /* 0 stands for not computed yet */
+    e->hash = (uint32_t) h ? (uint32_t) h : 1;
+    return e->hash;
+}
+
+/* Slot of the table of q_delete_dup_unsorted() */
+typedef struct {
+    element_t *first; /* First element holding the string, NULL if free */
+    uint32_t hash;
+    bool dup; /* first has been seen again, and waits to be released */
+} dup_slot_t;
+
+bool q_delete_dup_unsorted(struct list_head *head)
+{
+    if (!head)
+        return false;
+    queue_t *q = to_queue(head);
+    if (q->size < 2)
+        return true;
+
+    /* Open addressing with linear probing, kept at most half full */
+    size_t nslots = 2;
+    while (nslots < 2 * (size_t) q->size)
+        nslots <<= 1;
+    dup_slot_t *table = (dup_slot_t *) malloc(nslots * sizeof(dup_slot_t));
+    if (!table)
+        return false;
+    memset(table, 0, nslots * sizeof(dup_slot_t));
+    q->mid = NULL;
+
+    /*
+     * A later occurrence is released on sight. The first one is moved out
+     * to dups instead, as the slot still compares against its string.
+     */
+    LIST_HEAD(dups);
+    struct list_head *node, *safe;
+    list_for_each_safe (node, safe, head) {
+        element_t *e = list_entry(node, element_t, list);
+        uint32_t h = element_hash(e);
+        dup_slot_t *slot = &table[h & (nslots - 1)];
+        while (slot->first && (slot->hash != h || !same_value(slot->first, e)))
+            slot = slot + 1 < table + nslots ? slot + 1 : table;
+
+        if (!slot->first) {
+            slot->first = e;
+            slot->hash = h;
+            continue;
+        }
+        if (!slot->dup) {
+            slot->dup = true;
+            list_move_tail(&slot->first->list, &dups);
+            q->size--;
+        }
+        list_del(node);
+        q_release_element(e);
+        q->size--;
+    }
+    free(table);
+
+    element_t *e, *next;
+    list_for_each_entry_safe (e, next, &dups, list)
+        q_release_element(e);
+
+    return true;
+}
+
 /*
  * Exchange two adjacent nodes and reture pointer a
  */
@@ -299,6 +848,9 @@ void q_swap(struct list_head *head)
     //     right = left->next;
     // }
 
+    q_materialize(head);
+    to_queue(head)->mid = NULL;
+
     struct list_head *node;
     for (node = head->next; (node->next != head) && (node != head);
          node = node->next) {
@@ -321,11 +873,14 @@ void q_reverse(struct list_head *head)
     if (!head || list_empty(head))
         return;
 
-    struct list_head *node = NULL;
-    struct list_head *safe = NULL;
-    list_for_each_safe (node, safe, head) {
-        list_move(node, head);
-    }
+    // The node at index i ends up at size - 1 - i. For an odd size the
+    // middle one stays, for an even size the one before it takes over.
+    queue_t *q = to_queue(head);
+    if (q->mid && !(q->size & 1))
+        q->mid = q_prev(head, q->mid);
+
+    // Only the direction of the list changes, the nodes stay where they are.
+    q->reversed = !q->reversed;
 
     // struct list_head *h = head->next;
     // struct list_head *t = head->prev;
@@ -343,45 +898,157 @@ void q_reverse(struct list_head *head)
     // }
 }
 
-struct list_head *sorted_merge(struct list_head *front, struct list_head *back)
+/*
+ * Sorting engine
+ *
+ * q_sort() is a bottom-up natural merge sort which never recurses, in the
+ * spirit of list_sort() in the Linux kernel. The list is first treated as a
+ * NULL-terminated singly-linked chain through the next pointers; the prev
+ * pointers are only restored once the final merge is done.
+ *
+ * The input is consumed as a sequence of natural runs: a maximal ascending
+ * run is taken as it is, and a strictly descending run is reversed in place
+ * (strictly, so that equal elements keep their relative order and the sort
+ * stays stable). Already sorted input and the output of q_reverse() on sorted
+ * input therefore cost a single O(n) pass.
+ *
+ * Runs waiting to be merged are kept on a small stack. After each push, the
+ * two topmost runs are merged as long as the lower one is no more than twice
+ * as long as the upper one. This keeps every run on the stack at least twice
+ * as long as the one above it, so the stack depth is bounded by log2(n) + 1
+ * and MAX_PENDING runs are enough for any list that fits in memory.
+ */
+
+#define MAX_PENDING 64
+
+struct run {
+    struct list_head *head; /* NULL-terminated chain of elements */
+    size_t len;
+};
+
+static inline int cmp_element(struct list_head *a, struct list_head *b)
+{
+    return cmp_value(list_entry(a, element_t, list),
+                     list_entry(b, element_t, list));
+}
+
+/*
+ * Merge two non-empty NULL-terminated chains into one.
+ * On ties the element from a comes first, which keeps the sort stable.
+ */
+static struct list_head *merge(struct list_head *a, struct list_head *b)
 {
-    if (!front || !back)
-        return front ? front : back;
+    struct list_head *head = NULL, **tail = &head;
+
+    for (;;) {
+        if (cmp_element(a, b) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
+        } else {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        }
+    }
 
-    struct list_head *result = NULL;
+    return head;
+}
 
-    if (strcmp(list_entry(front, element_t, list)->value,
-               list_entry(back, element_t, list)->value) > 0) {
-        result = back;
-        result->next = sorted_merge(front, back->next);
+/*
+ * Detach the natural run starting at *list and advance *list past it.
+ * The returned run is always in ascending order.
+ */
+static struct run next_run(struct list_head **list)
+{
+    struct list_head *head = *list, *cur = head, *next = head->next;
+    struct run r = {.head = head, .len = 1};
+
+    if (next && cmp_element(cur, next) > 0) {
+        /* Strictly descending: reverse it while walking */
+        head->next = NULL;
+        while (next && cmp_element(cur, next) > 0) {
+            struct list_head *after = next->next;
+            next->next = cur;
+            cur = next;
+            next = after;
+            r.len++;
+        }
+        r.head = cur;
     } else {
-        result = front;
-        result->next = sorted_merge(front->next, back);
+        while (next && cmp_element(cur, next) <= 0) {
+            cur = next;
+            next = next->next;
+            r.len++;
+        }
+        cur->next = NULL;
     }
 
-    return result;
+    *list = next;
+    return r;
 }
 
-
-void merge_sort(struct list_head **head)
+/*
+ * Push run on the top runs of pending, merging them as long as the one below
+ * the top is not more than twice as long as the top one. The runs thus
+ * shrink geometrically towards the top, so that there are no more than
+ * log2(n) + 1 of them. Return the new number of runs.
+ */
+static int push_run(struct run *pending, int top, struct run run)
 {
-    if (!*head || !(*head)->next)
-        return;
+    pending[top++] = run;
+    while (top > 1 && pending[top - 2].len <= 2 * pending[top - 1].len) {
+        pending[top - 2].head =
+            merge(pending[top - 2].head, pending[top - 1].head);
+        pending[top - 2].len += pending[top - 1].len;
+        top--;
+    }
+    return top;
+}
 
-    struct list_head *slow = *head, *fast = slow->next;
-    while (fast && fast->next) {
-        slow = slow->next;
-        fast = fast->next->next;
+/* Merge the top runs of pending into one, return its chain */
+static struct list_head *collapse_runs(struct run *pending, int top)
+{
+    while (top > 1) {
+        pending[top - 2].head =
+            merge(pending[top - 2].head, pending[top - 1].head);
+        pending[top - 2].len += pending[top - 1].len;
+        top--;
     }
+    return pending[0].head;
+}
 
-    struct list_head *front = *head;
-    struct list_head *back = slow->next;
-    slow->next = NULL;
+/* Sort the non-empty NULL-terminated chain list, return the sorted chain */
+static struct list_head *sort_chain(struct list_head *list)
+{
+    struct run pending[MAX_PENDING];
+    int top = 0;
 
-    merge_sort(&front);
-    merge_sort(&back);
+    while (list)
+        top = push_run(pending, top, next_run(&list));
 
-    *head = sorted_merge(front, back);
+    return collapse_runs(pending, top);
+}
+
+/* Make head a circular list of the NULL-terminated chain, restoring prev */
+static void relink(struct list_head *head, struct list_head *chain)
+{
+    struct list_head *prev = head;
+    for (struct list_head *list = chain; list; list = list->next) {
+        prev->next = list;
+        list->prev = prev;
+        prev = list;
+    }
+    prev->next = head;
+    head->prev = prev;
 }
 
 /*
@@ -394,16 +1061,223 @@ void q_sort(struct list_head *head)
     if (!head || list_empty(head) || list_is_singular(head))
         return;
 
+    // Equal elements have to keep their order in the queue.
+    q_materialize(head);
+    to_queue(head)->mid = NULL;
+
     // Let linked list to be singly linked list.
     head->prev->next = NULL;
-    merge_sort(&head->next);
+    relink(head, sort_chain(head->next));
+}
+
+/*
+ * Parallel sort: the queue is cut into one part per thread, each part is
+ * sorted into a circular list of its own, and the parts are then merged
+ * through a binary heap of their front elements. Everything lives on the
+ * stack, hence the bound on the number of threads.
+ */
+
+#define MAX_SORT_THREADS 64
+
+/* Fewer elements per thread than this are not worth starting a thread */
+#define MIN_SORT_CHUNK 1024
+
+static void *sort_part(void *arg)
+{
+    struct list_head *part = arg;
+    part->prev->next = NULL;
+    relink(part, sort_chain(part->next));
+    return NULL;
+}
+
+/*
+ * Whether the front of part a goes before the front of part b.
+ * Parts hold consecutive stretches of the queue, so on ties the lower part
+ * goes first, which keeps the sort stable.
+ */
+static inline bool part_before(struct list_head *parts, int a, int b)
+{
+    int cmp = cmp_element(parts[a].next, parts[b].next);
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
+static void sift_down(struct list_head *parts, int *heap, int n, int i)
+{
+    for (;;) {
+        int min = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && part_before(parts, heap[l], heap[min]))
+            min = l;
+        if (r < n && part_before(parts, heap[r], heap[min]))
+            min = r;
+        if (min == i)
+            return;
+        int tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/* Merge the n sorted non-empty parts into the empty queue head */
+static void merge_parts(struct list_head *head, struct list_head *parts, int n)
+{
+    int heap[MAX_SORT_THREADS];
+    for (int i = 0; i < n; i++)
+        heap[i] = i;
+    for (int i = n / 2 - 1; i >= 0; i--)
+        sift_down(parts, heap, n, i);
+
+    struct list_head *chain = NULL, **tail = &chain;
+    while (n) {
+        int i = heap[0];
+        struct list_head *node = parts[i].next;
+        *tail = node;
+        tail = &node->next;
+        parts[i].next = node->next;
+        if (parts[i].next == &parts[i])
+            heap[0] = heap[--n];
+        sift_down(parts, heap, n, 0);
+    }
+    *tail = NULL;
+
+    relink(head, chain);
+}
+
+void q_sort_parallel(struct list_head *head, int nthreads)
+{
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
+
+    int size = to_queue(head)->size;
+    if (nthreads > MAX_SORT_THREADS)
+        nthreads = MAX_SORT_THREADS;
+    if (nthreads > size / MIN_SORT_CHUNK)
+        nthreads = size / MIN_SORT_CHUNK;
+    if (nthreads < 2) {
+        q_sort(head);
+        return;
+    }
+
+    q_materialize(head);
+    to_queue(head)->mid = NULL;
 
-    struct list_head *tmp = head;
-    while (tmp->next) {
-        tmp->next->prev = tmp;
-        tmp = tmp->next;
+    struct list_head parts[MAX_SORT_THREADS];
+    int left = size;
+    for (int i = 0; i < nthreads - 1; i++) {
+        int len = size / nthreads + (i < size % nthreads);
+        list_cut_position(&parts[i], head, nth_node(head, left, len));
+        left -= len;
+    }
+    INIT_LIST_HEAD(&parts[nthreads - 1]);
+    list_splice_init(head, &parts[nthreads - 1]);
+
+    /*
+     * The workers block every signal, so that a signal meant for qtest is
+     * handled by this thread. This thread in turn holds back the alarm of
+     * the time limit until the parts are merged: jumping out from here would
+     * leave the workers sorting parts that live in this frame.
+     */
+    pthread_t tid[MAX_SORT_THREADS];
+    bool started[MAX_SORT_THREADS];
+    sigset_t all, held, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (int i = 1; i < nthreads; i++)
+        started[i] = !pthread_create(&tid[i], NULL, sort_part, &parts[i]);
+    held = old;
+    sigaddset(&held, SIGALRM);
+    pthread_sigmask(SIG_SETMASK, &held, NULL);
+
+    sort_part(&parts[0]);
+    for (int i = 1; i < nthreads; i++) {
+        if (started[i])
+            pthread_join(tid[i], NULL);
+        else
+            sort_part(&parts[i]);
+    }
+
+    merge_parts(head, parts, nthreads);
+
+    /* An alarm that came meanwhile is delivered now */
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * Give q the storage of from, whose elements are about to join q, so that
+ * they remain valid whatever becomes of from.
+ */
+static void adopt_storage(queue_t *q, queue_t *from)
+{
+    from->foreign = false;
+
+    if (from->pool && q->pool)
+        pool_adopt(q->pool, from->pool);
+    else if (from->pool) {
+        /* from carries on with elements from malloc */
+        q->pool = from->pool;
+        from->pool = NULL;
+    }
+
+    if (from->chunks && q->chunks)
+        chunk_adopt(q->chunks, from->chunks);
+    else if (from->chunks) {
+        q->chunks = from->chunks;
+        from->chunks = NULL;
+    }
+}
+
+/*
+ * The queues are merged as the runs of the sort are, in chain order and
+ * balanced by length, which takes O(n log k) time and just the fixed stack
+ * of pending runs, however many queues there are.
+ */
+int q_merge(struct list_head *chain)
+{
+    if (!chain || list_empty(chain))
+        return 0;
+
+    queue_context_t *first = list_first_entry(chain, queue_context_t, chain);
+    if (!first->q)
+        return 0;
+    queue_t *q = to_queue(first->q);
+
+    /* Once pooled and other elements are mixed in q, q_free() can no longer
+     * drop its slabs wholesale
+     */
+    bool others = false;
+    queue_context_t *ctx;
+    list_for_each_entry (ctx, chain, chain) {
+        if (!ctx->q || list_empty(ctx->q))
+            continue;
+        queue_t *from = to_queue(ctx->q);
+        others = others || !from->pool || from->foreign;
+        if (from != q)
+            adopt_storage(q, from);
+    }
+    q->foreign = q->pool && others;
+
+    struct run pending[MAX_PENDING];
+    int top = 0, size = 0;
+    list_for_each_entry (ctx, chain, chain) {
+        if (!ctx->q || list_empty(ctx->q))
+            continue;
+
+        queue_t *from = to_queue(ctx->q);
+        q_materialize(ctx->q);
+        ctx->q->prev->next = NULL;
+        struct run run = {.head = ctx->q->next, .len = from->size};
+        INIT_LIST_HEAD(ctx->q);
+        size += from->size;
+        from->size = 0;
+        from->mid = NULL;
+        top = push_run(pending, top, run);
     }
 
-    tmp->next = head;
-    head->prev = tmp;
+    /* An empty first queue was skipped above, but may still be reversed */
+    q->reversed = false;
+    q->mid = NULL;
+    if (top)
+        relink(first->q, collapse_runs(pending, top));
+    q->size = size;
+    return size;
 }
@@ -10,17 +10,124 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "list.h"
 
 /* Linked list element */
 typedef struct {
     /* Pointer to array holding string.
-     * This array needs to be explicitly allocated and freed
+     * This array needs to be explicitly allocated and freed, unless it is
+     * stored inline, in which case value points to data, or interned, in
+     * which case it is shared and must not be modified.
      */
     char *value;
     struct list_head list;
+    /* First 8 bytes of the string packed big-endian and padded with zeros,
+     * so that comparing keys as integers orders them as strcmp does.
+     */
+    uint64_t key;
+    /* Length of the string, saturating at 2^24 - 1 */
+    uint32_t len : 24;
+    /* How the element was allocated, private to queue.c */
+    uint32_t flags : 8;
+    /* Hash of the string, 0 until q_delete_dup_unsorted() first needs it */
+    uint32_t hash;
+    /* Inline storage of the string, allocated along with the element */
+    char data[];
 } element_t;
 
+/*
+ * Element layout used by q_insert_head() and q_insert_tail().
+ * Non-zero: the string is copied into data, so each insertion takes a single
+ *           allocation and the string shares cache lines with the links.
+ * Zero:     the string is copied into a separately allocated buffer.
+ * Both layouts may coexist in one queue, q_release_element() handles either.
+ */
+extern int q_inline_value;
+
+/*
+ * Non-zero: queues created by q_new() get their own slab allocator, see
+ * pool.h. Elements and strings then come from per-queue size-classed slabs,
+ * and q_free() returns all of them at once.
+ */
+extern int q_use_pool;
+
+/*
+ * Non-zero: q_insert_head() and q_insert_tail() do not copy the string, but
+ * take a reference to its copy in the intern table, see intern.h, which
+ * holds every distinct string once. Elements inserted meanwhile thus share
+ * the strings they have in common, and the element itself is the only
+ * allocation per insertion. q_release_element() drops the reference.
+ * Overrides q_inline_value, and may be switched at any time.
+ */
+extern int q_intern_value;
+
+/*
+ * Queue descriptor
+ * q_new() hands out a pointer to the embedded head, and every operation
+ * below recovers the descriptor from it. Hence the head must be the first
+ * member, and only heads returned by q_new() may be passed to the q_*
+ * functions.
+ */
+typedef struct {
+    struct list_head head;
+    /* Number of elements, kept up to date by every operation */
+    int size;
+    /* Node at index size / 2 once q_delete_mid() has found it, else NULL.
+     * Insertions and removals at the ends move it along, operations which
+     * rearrange the queue or change many nodes at once reset it.
+     */
+    struct list_head *mid;
+    /* Set while the queue runs from the tail of the list to its head */
+    bool reversed;
+    /* Set once q_merge() has mixed elements from outside pool with those
+     * from it, so that q_free() has to release them one by one.
+     */
+    bool foreign;
+    /* Slab allocator of this queue, NULL when q_use_pool was off */
+    struct pool *pool;
+    /* Chunks holding the elements, NULL unless built with QUEUE=chunked */
+    struct chunk_deque *chunks;
+} queue_t;
+
+/*
+ * Walking a queue in queue order
+ * Since q_reverse() only flips the direction of the queue, the list may
+ * hold the elements backwards. Code outside queue.c thus follows these
+ * instead of the next and prev links, unless it calls q_materialize()
+ * first. The first and the last node are head itself if queue is empty, and
+ * so is the node after the last and the one before the first.
+ */
+static inline struct list_head *q_next(struct list_head *head,
+                                       struct list_head *node)
+{
+    return container_of(head, queue_t, head)->reversed ? node->prev
+                                                        : node->next;
+}
+
+static inline struct list_head *q_prev(struct list_head *head,
+                                       struct list_head *node)
+{
+    return container_of(head, queue_t, head)->reversed ? node->next
+                                                        : node->prev;
+}
+
+static inline struct list_head *q_first(struct list_head *head)
+{
+    return q_next(head, head);
+}
+
+static inline struct list_head *q_last(struct list_head *head)
+{
+    return q_prev(head, head);
+}
+
+/* Iterate over the elements of queue, which must not be removed meanwhile */
+#define q_for_each_entry(entry, head)                               \
+    for (entry = list_entry(q_first(head), element_t, list);        \
+         &entry->list != (head);                                    \
+         entry = list_entry(q_next(head, &entry->list), element_t, list))
+
 /* Operations on queue */
 
 /*
@@ -32,6 +139,8 @@ struct list_head *q_new();
 /*
  * Free ALL storage used by queue.
  * No effect if q is NULL
+ * For a queue with a slab allocator or chunks, elements removed from it must
+ * have been released beforehand, since their memory goes away with the queue.
  */
 void q_free(struct list_head *head);
 
@@ -53,6 +162,23 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/*
+ * Attempt to insert n elements at head of queue, with the same result as
+ * calling q_insert_head() on s[0], s[1], ..., s[n - 1] in turn.
+ * All elements are allocated into a detached chain first, which is then
+ * spliced in at once. Either all n are inserted and true is returned, or the
+ * queue is left untouched and false is returned.
+ * Return false if q is NULL, n is not positive or could not allocate space.
+ */
+bool q_insert_head_bulk(struct list_head *head, char **s, int n);
+
+/*
+ * Attempt to insert n elements at tail of queue, with the same result as
+ * calling q_insert_tail() on s[0], s[1], ..., s[n - 1] in turn.
+ * Other attribute is as same as q_insert_head_bulk.
+ */
+bool q_insert_tail_bulk(struct list_head *head, char **s, int n);
+
 /*
  * Attempt to remove element from head of queue.
  * Return target element.
@@ -75,6 +201,25 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/*
+ * Attempt to remove the first k elements of queue at once.
+ * They are moved, in queue order, into the list to, which is initialized
+ * first, so its previous content is lost. No string is copied.
+ * Remove all elements if the queue holds fewer than k.
+ * Return the number of elements removed, 0 if queue is NULL or empty.
+ *
+ * As with q_remove_head, the removed elements still have to be released.
+ * Runs in O(min(k, n - k)) time, and O(1) if k is at least the queue size.
+ * A reversed queue also pays O(k) to put the removed elements in queue order.
+ */
+int q_remove_head_n(struct list_head *head, struct list_head *to, int k);
+
+/*
+ * Attempt to remove the last k elements of queue at once.
+ * Other attribute is as same as q_remove_head_n.
+ */
+int q_remove_tail_n(struct list_head *head, struct list_head *to, int k);
+
 /*
  * Attempt to release element.
  */
@@ -83,6 +228,7 @@ void q_release_element(element_t *e);
 /*
  * Return number of elements in queue.
  * Return 0 if q is NULL or empty
+ * The count is cached in queue_t, so this takes constant time.
  */
 int q_size(struct list_head *head);
 
@@ -93,6 +239,8 @@ int q_size(struct list_head *head);
  * If there're six element, the third member should be return.
  * Return true if successful.
  * Return false if list is NULL or empty.
+ * Takes O(1) time, except after q_new() and after operations which reset
+ * the middle cursor of the queue, when the middle is found in O(n).
  *
  * Ref: https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
  */
@@ -108,6 +256,15 @@ bool q_delete_mid(struct list_head *head);
  */
 bool q_delete_dup(struct list_head *head);
 
+/*
+ * Delete all nodes that have duplicate string like q_delete_dup, from a
+ * list in any order. The remaining nodes keep their order.
+ * Takes O(n) expected time, and O(n) space for a hash table of the strings.
+ * Return false if list is NULL or could not allocate space, leaving the
+ * list untouched in the latter case.
+ */
+bool q_delete_dup_unsorted(struct list_head *head);
+
 /*
  * Attempt to swap every two adjacent nodes.
  *
@@ -120,10 +277,19 @@ void q_swap(struct list_head *head);
  * No effect if q is NULL or empty
  * This function should not allocate or free any list elements
  * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
- * It should rearrange the existing ones.
+ * Takes O(1) time: the list is left as it is, and only read backwards from
+ * then on, see q_next(). Operations needing the elements in list order,
+ * such as sorting and swapping, rearrange them first.
  */
 void q_reverse(struct list_head *head);
 
+/*
+ * Rearrange the list so that it holds the elements in queue order, which
+ * is left unchanged. Takes O(n) time after a q_reverse(), O(1) otherwise.
+ * No effect if q is NULL.
+ */
+void q_materialize(struct list_head *head);
+
 /*
  * Sort elements of queue in ascending order
  * No effect if q is NULL or empty. In addition, if q has only one
@@ -131,4 +297,37 @@ void q_reverse(struct list_head *head);
  */
 void q_sort(struct list_head *head);
 
+/*
+ * Sort elements of queue in ascending order like q_sort, with up to nthreads
+ * threads sorting parts of the queue at the same time.
+ * Takes no heap memory. At most 64 threads are used, and only as many as
+ * leave each at least 1024 elements; with fewer than two, this is q_sort.
+ * Once the threads are started, the sort cannot be interrupted: a SIGALRM
+ * arriving meanwhile is held until the queue is sorted.
+ */
+void q_sort_parallel(struct list_head *head, int nthreads);
+
+/*
+ * Entry of a chain of queues, as passed to q_merge()
+ * q is a queue returned by q_new(), or NULL. id is left to the owner of the
+ * chain.
+ */
+typedef struct {
+    struct list_head *q;
+    struct list_head chain;
+    int id;
+} queue_context_t;
+
+/*
+ * Merge all the queues in chain, each sorted in ascending order, into the
+ * first one, leaving the others empty. Equal elements keep the order of the
+ * queues they come from along the chain, so the merge is stable.
+ * The first queue takes over the storage of the others, hence the merged
+ * elements remain valid when the other queues are freed.
+ * Takes O(n log k) time for n elements in k queues, and allocates nothing.
+ * Return the number of elements in the first queue, 0 if chain is NULL or
+ * empty, or if its first queue is NULL.
+ */
+int q_merge(struct list_head *chain);
+
 #endif /* LAB0_QUEUE_H */
@@ -1,7 +1,9 @@
 #include "random.h"
 #include <assert.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 /* shameless stolen from ebacs */
@@ -37,3 +39,74 @@ void randombytes(uint8_t *x, size_t how_much)
         xlen -= i;
     }
 }
+
+/*
+ * xoshiro256** by David Blackman and Sebastiano Vigna, public domain.
+ * See https://prng.di.unimi.it/
+ */
+static uint64_t state[4];
+static bool seeded = false;
+
+static inline uint64_t rotl(const uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* splitmix64, used to expand a seed into the generator state */
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void prng_seed(uint64_t seed)
+{
+    /* splitmix64 never yields an all-zero state, which xoshiro cannot leave */
+    for (int i = 0; i < 4; i++)
+        state[i] = splitmix64(&seed);
+    seeded = true;
+}
+
+uint64_t prng_next(void)
+{
+    if (!seeded) {
+        uint64_t seed;
+        randombytes((uint8_t *) &seed, sizeof(seed));
+        prng_seed(seed);
+    }
+
+    const uint64_t result = rotl(state[1] * 5, 7) * 9;
+    const uint64_t t = state[1] << 17;
+
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotl(state[3], 45);
+
+    return result;
+}
+
+void prng_fill(uint8_t *x, size_t xlen)
+{
+    while (xlen >= sizeof(uint64_t)) {
+        uint64_t r = prng_next();
+        memcpy(x, &r, sizeof(r));
+        x += sizeof(r);
+        xlen -= sizeof(r);
+    }
+
+    if (xlen > 0) {
+        uint64_t r = prng_next();
+        memcpy(x, &r, xlen);
+    }
+}
+
+void prng_fill_range(uint32_t *x, size_t xlen, uint32_t bound)
+{
+    for (size_t i = 0; i < xlen; i++)
+        x[i] = prng_range(bound);
+}
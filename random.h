@@ -4,13 +4,34 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Fill x with bytes from the operating system. Slow, meant for seeding */
 void randombytes(uint8_t *x, size_t xlen);
 
+/*
+ * Fast deterministic generator (xoshiro256**) for hot loops.
+ * Unless prng_seed() is called first, it is seeded from randombytes() on
+ * first use. The same seed always yields the same sequence.
+ */
+void prng_seed(uint64_t seed);
+
+/* Next 64 random bits */
+uint64_t prng_next(void);
+
+/* Uniform value in [0, bound), without division. bound must be non-zero */
+static inline uint32_t prng_range(uint32_t bound)
+{
+    return (uint32_t) (((prng_next() >> 32) * bound) >> 32);
+}
+
+/* Fill x with xlen random bytes */
+void prng_fill(uint8_t *x, size_t xlen);
+
+/* Fill x with xlen values, each uniform in [0, bound) */
+void prng_fill_range(uint32_t *x, size_t xlen, uint32_t bound);
+
 static inline uint8_t randombit(void)
 {
-    uint8_t ret = 0;
-    randombytes(&ret, 1);
-    return ret & 1;
+    return prng_next() >> 63;
 }
 
 #endif
@@ -24,6 +24,119 @@ static void init_files(FILE *efile, FILE *vfile)
     verbfile = vfile;
 }
 
+/*
+ * Buffered output mode.
+ * Text for the terminal and for the log file piles up in one buffer each,
+ * written with a single write() once it would overflow. This keeps long runs
+ * at high verbosity from spending their time in system calls.
+ * Error messages share the buffer of verbfile, since they go to the same
+ * place, and must stay in order with the rest.
+ */
+int report_buffering = 0;
+
+#define REPORT_BUFSIZE (1 << 20)
+
+typedef struct {
+    size_t len;
+    char data[REPORT_BUFSIZE];
+} outbuf_t;
+
+static outbuf_t verb_buf, log_buf;
+
+static report_sink_t report_sink = NULL;
+
+void set_report_sink(report_sink_t sink)
+{
+    report_sink = sink;
+}
+
+/* Format the text for verbfile, and hand it over to the sink instead */
+static void sink_vprintf(char *fmt, va_list ap)
+{
+    char text[MAX_CHAR];
+    va_list aq;
+    va_copy(aq, ap);
+    int n = vsnprintf(text, sizeof(text), fmt, aq);
+    va_end(aq);
+    if (n < 0)
+        return;
+    if ((size_t) n < sizeof(text)) {
+        report_sink(text, n);
+        return;
+    }
+
+    char *big = malloc(n + 1);
+    if (!big)
+        return;
+    vsnprintf(big, n + 1, fmt, ap);
+    report_sink(big, n);
+    free(big);
+}
+
+/* Write the buffer of file f. Only uses write(), so works in signal handlers */
+static void outbuf_flush(outbuf_t *b, FILE *f)
+{
+    if (!f || b->len == 0)
+        return;
+
+    /* Anything f got from stdio precedes the buffered text */
+    fflush(f);
+    int fd = fileno(f);
+    char *p = b->data;
+    while (b->len > 0) {
+        ssize_t n = write(fd, p, b->len);
+        if (n <= 0)
+            break;
+        p += n;
+        b->len -= n;
+    }
+    b->len = 0;
+}
+
+static void outbuf_vprintf(outbuf_t *b, FILE *f, char *fmt, va_list ap)
+{
+    if (report_sink && b == &verb_buf) {
+        sink_vprintf(fmt, ap);
+        return;
+    }
+
+    if (!report_buffering) {
+        vfprintf(f, fmt, ap);
+        fflush(f);
+        return;
+    }
+
+    va_list aq;
+    va_copy(aq, ap);
+    int n = vsnprintf(b->data + b->len, REPORT_BUFSIZE - b->len, fmt, aq);
+    va_end(aq);
+    if (n < 0 || b->len + n < REPORT_BUFSIZE) {
+        b->len += n < 0 ? 0 : n;
+        return;
+    }
+
+    /* Did not fit, so the attempt is discarded */
+    outbuf_flush(b, f);
+    if (n < REPORT_BUFSIZE)
+        b->len = vsnprintf(b->data, REPORT_BUFSIZE, fmt, ap);
+    else
+        vfprintf(f, fmt, ap);
+}
+
+static void outbuf_printf(outbuf_t *b, FILE *f, char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    outbuf_vprintf(b, f, fmt, ap);
+    va_end(ap);
+}
+
+void report_flush()
+{
+    outbuf_flush(&verb_buf, verbfile);
+    outbuf_flush(&log_buf, logfile);
+}
+
 static char fail_buf[1024] = "FATAL Error.  Exiting\n";
 
 static volatile int ret = 0;
@@ -31,6 +144,7 @@ static volatile int ret = 0;
 /* Default fatal function */
 static void default_fatal_fun()
 {
+    report_flush();
     ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
     if (logfile)
         fputs(fail_buf, logfile);
@@ -67,25 +181,25 @@ void report_event(message_t msg, char *fmt, ...)
         init_files(stdout, stdout);
 
     va_start(ap, fmt);
-    fprintf(errfile, "%s: ", msg_name);
-    vfprintf(errfile, fmt, ap);
-    fprintf(errfile, "\n");
-    fflush(errfile);
+    outbuf_printf(&verb_buf, errfile, "%s: ", msg_name);
+    outbuf_vprintf(&verb_buf, errfile, fmt, ap);
+    outbuf_printf(&verb_buf, errfile, "\n");
     va_end(ap);
 
     if (logfile) {
         va_start(ap, fmt);
-        fprintf(logfile, "Error: ");
-        vfprintf(logfile, fmt, ap);
-        fprintf(logfile, "\n");
-        fflush(logfile);
+        outbuf_printf(&log_buf, logfile, "Error: ");
+        outbuf_vprintf(&log_buf, logfile, fmt, ap);
+        outbuf_printf(&log_buf, logfile, "\n");
         va_end(ap);
-        fclose(logfile);
     }
 
     if (fatal) {
+        report_flush();
         if (fatal_fun)
             fatal_fun();
+        if (logfile)
+            fclose(logfile);
         exit(1);
     }
 }
@@ -98,16 +212,14 @@ void report(int level, char *fmt, ...)
     if (level <= verblevel) {
         va_list ap;
         va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fprintf(verbfile, "\n");
-        fflush(verbfile);
+        outbuf_vprintf(&verb_buf, verbfile, fmt, ap);
+        outbuf_printf(&verb_buf, verbfile, "\n");
         va_end(ap);
 
         if (logfile) {
             va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fprintf(logfile, "\n");
-            fflush(logfile);
+            outbuf_vprintf(&log_buf, logfile, fmt, ap);
+            outbuf_printf(&log_buf, logfile, "\n");
             va_end(ap);
         }
     }
@@ -121,14 +233,12 @@ void report_noreturn(int level, char *fmt, ...)
     if (level <= verblevel) {
         va_list ap;
         va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fflush(verbfile);
+        outbuf_vprintf(&verb_buf, verbfile, fmt, ap);
         va_end(ap);
 
         if (logfile) {
             va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fflush(logfile);
+            outbuf_vprintf(&log_buf, logfile, fmt, ap);
             va_end(ap);
         }
     }
@@ -139,6 +249,7 @@ void report_noreturn(int level, char *fmt, ...)
 /* Need to be able to print without using malloc */
 static void fail_fun(char *format, char *msg)
 {
+    report_flush();
     snprintf(fail_buf, sizeof(fail_buf), format, msg);
     /* Tack on return */
     fail_buf[strlen(fail_buf)] = '\n';
@@ -274,6 +385,14 @@ void free_string(char *s)
     free_block((void *) s, strlen(s) + 1);
 }
 
+void report_mem_usage(int level)
+{
+    report(level, "Console blocks: %lu allocated, %lu freed", allocate_cnt,
+           free_cnt);
+    report(level, "Console bytes: %lu current, %lu peak", current_bytes,
+           peak_bytes);
+}
+
 /* Initialization of timers */
 void init_time(double *timep)
 {
@@ -3,6 +3,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /* Default reporting level.  Must recompile when change */
 #ifndef RPT
@@ -22,6 +23,24 @@ bool set_logfile(char *file_name);
 extern int verblevel;
 void set_verblevel(int level);
 
+/*
+ * When nonzero, output is collected in userspace buffers and only written
+ * once they fill up, or by report_flush()
+ */
+extern int report_buffering;
+
+/* Write out whatever buffered output is pending */
+void report_flush();
+
+/*
+ * Receiver of text reported for the terminal, in place of verbfile.
+ * The log file gets its copy all the same.
+ */
+typedef void (*report_sink_t)(const char *text, size_t len);
+
+/* Send terminal output to sink from now on, or to verbfile again if NULL */
+void set_report_sink(report_sink_t sink);
+
 /* Error messages */
 void report_event(message_t msg, char *fmt, ...);
 
@@ -49,6 +68,9 @@ void free_array(void *b, size_t cnt, size_t bytes);
 /* Free string saved by strsave_or_fail */
 void free_string(char *s);
 
+/* Show memory used through the functions above */
+void report_mem_usage(int verblevel);
+
 /** Time measurement.  **/
 
 /* Time counted as fp number in seconds */
@@ -0,0 +1,292 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "report.h"
+#include "server.h"
+
+/* Bytes asked from recv() at once */
+#define READ_CHUNK 65536
+
+/* A client sending this much without a newline is cut off */
+#define MAX_LINE (1 << 20)
+
+/*
+ * With this much of its answers not sent yet, a client gets no more of its
+ * commands run, and is not read from, until it has caught up
+ */
+#define MAX_PENDING_OUT (1 << 20)
+
+typedef struct {
+    char *data;
+    size_t len, size;
+} buf_t;
+
+typedef struct client {
+    int fd;
+    buf_t in;       /* Received, and not run yet */
+    buf_t out;      /* Answers, sent up to out_pos */
+    size_t out_pos;
+    bool eof;       /* The client has closed its end */
+    bool broken;    /* The connection failed, or memory ran out */
+    struct client *next;
+} client_t;
+
+static int listen_fd = -1;
+static int listen_port = 0;
+static client_t *clients = NULL;
+
+/* Client whose command is running, which gets everything reported meanwhile */
+static client_t *capturing = NULL;
+
+/* Make room for n more bytes in b. Return false if could not allocate */
+static bool buf_reserve(buf_t *b, size_t n)
+{
+    if (b->len + n <= b->size)
+        return true;
+
+    size_t size = b->size ? 2 * b->size : READ_CHUNK;
+    while (size < b->len + n)
+        size *= 2;
+    char *data = realloc(b->data, size);
+    if (!data)
+        return false;
+    b->data = data;
+    b->size = size;
+    return true;
+}
+
+static bool buf_append(buf_t *b, const char *p, size_t n)
+{
+    if (!buf_reserve(b, n))
+        return false;
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+    return true;
+}
+
+static inline size_t pending_out(const client_t *c)
+{
+    return c->out.len - c->out_pos;
+}
+
+static bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool server_open(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0 || !set_nonblocking(fd) ||
+        getsockname(fd, (struct sockaddr *) &addr, &len) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return false;
+    }
+
+    listen_fd = fd;
+    listen_port = ntohs(addr.sin_port);
+    return true;
+}
+
+bool server_active()
+{
+    return listen_fd >= 0;
+}
+
+int server_port()
+{
+    return listen_port;
+}
+
+int server_fdset(fd_set *readfds, fd_set *writefds)
+{
+    if (listen_fd < 0)
+        return 0;
+
+    FD_SET(listen_fd, readfds);
+    int max_fd = listen_fd;
+    for (client_t *c = clients; c; c = c->next) {
+        if (!c->eof && pending_out(c) < MAX_PENDING_OUT)
+            FD_SET(c->fd, readfds);
+        if (pending_out(c))
+            FD_SET(c->fd, writefds);
+        if (c->fd > max_fd)
+            max_fd = c->fd;
+    }
+    return max_fd + 1;
+}
+
+static void accept_clients()
+{
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            return;
+
+        client_t *c = calloc(1, sizeof(client_t));
+        if (!c || fd >= FD_SETSIZE || !set_nonblocking(fd)) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->next = clients;
+        clients = c;
+    }
+}
+
+static void client_read(client_t *c)
+{
+    if (!buf_reserve(&c->in, READ_CHUNK)) {
+        c->broken = true;
+        return;
+    }
+
+    ssize_t n = recv(c->fd, c->in.data + c->in.len, c->in.size - c->in.len, 0);
+    if (n > 0)
+        c->in.len += n;
+    else if (n == 0)
+        c->eof = true;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        c->broken = true;
+}
+
+static void client_write(client_t *c)
+{
+    while (pending_out(c)) {
+        ssize_t n = send(c->fd, c->out.data + c->out_pos, pending_out(c),
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                c->broken = true;
+            return;
+        }
+        c->out_pos += n;
+    }
+    c->out.len = c->out_pos = 0;
+}
+
+static void capture(const char *text, size_t len)
+{
+    if (!buf_append(&capturing->out, text, len))
+        capturing->broken = true;
+}
+
+/* Run the complete lines received from c, as long as it keeps up */
+static void client_run(client_t *c, server_cmd_t run)
+{
+    /* Answers not sent yet move to the front, so that out stays small */
+    memmove(c->out.data, c->out.data + c->out_pos, pending_out(c));
+    c->out.len -= c->out_pos;
+    c->out_pos = 0;
+
+    size_t done = 0;
+    while (!c->broken && pending_out(c) < MAX_PENDING_OUT) {
+        char *line = c->in.data + done;
+        size_t left = c->in.len - done;
+        char *nl = memchr(line, '\n', left);
+        /* Once the client is done, its last line needs no newline */
+        if (!nl && (!c->eof || !left))
+            break;
+        size_t len = nl ? (size_t) (nl - line) + 1 : left;
+
+        report_flush();
+        capturing = c;
+        set_report_sink(capture);
+        bool ok = run(line, len);
+        set_report_sink(NULL);
+        capturing = NULL;
+
+        const char *status = ok ? "ok\n" : "failed\n";
+        if (!buf_append(&c->out, status, strlen(status)))
+            c->broken = true;
+        done += len;
+    }
+
+    memmove(c->in.data, c->in.data + done, c->in.len - done);
+    c->in.len -= done;
+    if (c->in.len >= MAX_LINE && !memchr(c->in.data, '\n', c->in.len))
+        c->broken = true;
+}
+
+static void drop_client(client_t *c)
+{
+    close(c->fd);
+    free(c->in.data);
+    free(c->out.data);
+    free(c);
+}
+
+int server_handle(fd_set *readfds, fd_set *writefds, server_cmd_t run)
+{
+    if (listen_fd < 0)
+        return 0;
+
+    int handled = 0;
+    if (FD_ISSET(listen_fd, readfds)) {
+        FD_CLR(listen_fd, readfds);
+        handled++;
+        accept_clients();
+    }
+
+    client_t **p = &clients;
+    while (*p) {
+        client_t *c = *p;
+        if (FD_ISSET(c->fd, readfds)) {
+            FD_CLR(c->fd, readfds);
+            handled++;
+            client_read(c);
+        }
+        if (FD_ISSET(c->fd, writefds)) {
+            FD_CLR(c->fd, writefds);
+            handled++;
+        }
+
+        /* The socket is most likely writable right after running commands */
+        client_run(c, run);
+        client_write(c);
+
+        if (c->broken || (c->eof && !c->in.len && !pending_out(c))) {
+            *p = c->next;
+            drop_client(c);
+        } else
+            p = &c->next;
+    }
+
+    return handled;
+}
+
+void server_close()
+{
+    while (clients) {
+        client_t *c = clients;
+        clients = c->next;
+        client_write(c);
+        drop_client(c);
+    }
+
+    if (listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+    listen_port = 0;
+}
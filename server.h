@@ -0,0 +1,57 @@
+#ifndef LAB0_SERVER_H
+#define LAB0_SERVER_H
+
+/*
+ * Command server
+ *
+ * Accepts TCP connections on a port of the loopback interface. A client
+ * sends commands as lines of text, and may send any number of them without
+ * waiting for the results. The commands of all clients run one at a time,
+ * those of each client in the order sent. Every command is answered with
+ * the output it reports, followed by a line reading "ok" or "failed".
+ * A client which closes its end gets the answers to the commands it has
+ * sent before its connection is closed.
+ *
+ * Every socket is non-blocking, and waited on along with the command input
+ * of the console by cmd_select().
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/select.h>
+
+/* Run the command in the len characters at line, return true if it worked */
+typedef bool (*server_cmd_t)(const char *line, size_t len);
+
+/*
+ * Start listening on port, or on a port picked by the system if it is 0.
+ * Return false, with errno set, if could not.
+ */
+bool server_open(int port);
+
+/* Whether the server is listening */
+bool server_active();
+
+/* Port the server listens on */
+int server_port();
+
+/*
+ * Add the sockets waiting to be read, or written, to the sets.
+ * Return the highest of them plus 1, or 0 if the server is not listening.
+ */
+int server_fdset(fd_set *readfds, fd_set *writefds);
+
+/*
+ * Handle the sockets of the server that select() found ready, running the
+ * commands received with run, and remove them from the sets.
+ * Return how many of the descriptors set in them belonged to the server.
+ */
+int server_handle(fd_set *readfds, fd_set *writefds, server_cmd_t run);
+
+/*
+ * Send as much of the pending answers as can go out without waiting, then
+ * close every connection and stop listening
+ */
+void server_close();
+
+#endif /* LAB0_SERVER_H */
@@ -0,0 +1,20 @@
+# Test of removing several elements at once from either end, down to empty
+option fail 10
+option malloc 0
+new
+ih RAND 100
+rh - 40
+rt - 50
+size
+it gerbil 5
+ih dolphin 3
+rh dolphin 3
+rt gerbil 5
+rhq 4
+size
+rt - 6
+rh - 1
+rt - 1
+rhq 2
+size
+free
@@ -0,0 +1,23 @@
+# Test of sampled and ends-only queue checks on sort, dedup and reverse
+option fail 0
+option malloc 0
+option verify 1
+option sample 2
+new
+ih RAND 5000
+it aaa 3
+size
+sort
+reverse
+sort
+dedup
+reverse
+option sample 3
+ih RAND 2000
+sort
+dedup
+option verify 2
+ih RAND 5000
+sort
+reverse
+free
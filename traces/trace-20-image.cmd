@@ -0,0 +1,37 @@
+# Test of saving a queue as an image, and loading it back in order
+option fail 0
+option malloc 0
+new
+it gerbil
+it bear
+it dolphin
+ih meerkat
+save /tmp/lab0-trace-20.img
+free
+new
+load /tmp/lab0-trace-20.img
+size
+rh meerkat
+rh gerbil
+rh bear
+rh dolphin
+size
+load /tmp/lab0-trace-20.img
+load /tmp/lab0-trace-20.img
+size
+rt - 4
+rh meerkat
+rt dolphin
+sort
+save /tmp/lab0-trace-20.img
+rhq 2
+save /tmp/lab0-trace-20.img
+load /tmp/lab0-trace-20.img
+size
+ih RAND 10000
+save /tmp/lab0-trace-20.img
+free
+new
+load /tmp/lab0-trace-20.img
+size
+free
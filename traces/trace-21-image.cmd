@@ -0,0 +1,14 @@
+# Test of rejecting images that are truncated, corrupted or not images at all
+option fail 0
+option malloc 0
+new
+it gerbil
+it bear
+xfail load traces/trace-21-truncated.img
+xfail load traces/trace-21-corrupt.img
+xfail load traces/trace-21-image.cmd
+xfail load traces/trace-21-missing.img
+size
+rh gerbil
+rh bear
+free
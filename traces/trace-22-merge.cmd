@@ -0,0 +1,72 @@
+# Test of merging sorted queues of all storage kinds, some of them empty
+option fail 0
+option malloc 0
+new
+ih RAND 300
+it zzzzzzzzzzzz 3
+sort
+new
+option pool 1
+new
+ih RAND 200
+ih a 2
+sort
+option intern 1
+new
+ih RAND 100
+it lemur 4
+ih zzzzzzzzzzzz
+sort
+option pool 0
+new
+option intern 0
+new
+it gerbil
+prev
+prev
+merge
+size
+rh a
+rh a
+rt zzzzzzzzzzzz
+rt zzzzzzzzzzzz
+rt zzzzzzzzzzzz
+rt zzzzzzzzzzzz
+size
+next
+size
+ih bear
+next
+next
+next
+next
+size
+merge
+size
+free
+free
+free
+free
+free
+size
+free
+new
+it a
+it b
+reverse
+rh b
+rh a
+new
+it x
+it y
+new
+it c
+it z
+merge
+rh c
+rh x
+rh y
+rh z
+free
+free
+free
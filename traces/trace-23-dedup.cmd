@@ -0,0 +1,27 @@
+# Test of deleting duplicate strings from a queue that is not sorted
+option fail 0
+option malloc 0
+option dedup 1
+new
+dedup
+it gerbil
+it bear
+it dolphin
+it bear
+it meerkat
+it gerbil
+it bear
+ih vulture
+dedup
+rh vulture
+rh dolphin
+rh meerkat
+size
+ih RAND 2000
+it gerbil 3
+ih gerbil 2
+dedup
+option dedup 0
+sort
+dedup
+free
@@ -0,0 +1,19 @@
+# Test of sorting with several threads
+option fail 0
+option malloc 0
+option threads 4
+new
+sort
+ih gerbil
+sort
+ih RAND 100000
+it gerbil 3
+sort
+reverse
+sort
+size
+option threads 3
+ih RAND 1001
+sort
+size
+free
@@ -0,0 +1,6 @@
+# Test of the concurrent queue with several producers, consumers and sorts
+option fail 0
+option malloc 0
+mt ih gerbil 1000
+mt it RAND 20000 producers 4 consumers 4
+mt it RAND 20000 producers 2 consumers 3 sorts 5